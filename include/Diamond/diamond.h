@@ -1,5 +1,6 @@
 #pragma once
 #include "structures.h"
+#include "profiler.h"
 
 #if DIAMOND_IMGUI
 #include "imgui/imgui_impl_vulkan.h"
@@ -20,8 +21,37 @@ public:
     * @param height Desired starting height of the window
     * @param windowName Desired name of the window and also name of the vulkan application
     * @param defaultTexturePath The path to the default texture the engine will fallback to in the case of a missing texture
+    * @param enableAsyncCompute Run compute work on a dedicated compute queue (if the device has one) overlapping the rendering of the previous frame
+    * @note Async compute keeps a copy of every staging vertex buffer per frame in flight and copies the previous frame's contents into the current
+    * one at the start of each frame. Pipelines using non staging vertex buffers or images still wait for the previous frame's rendering
     */
-    void Initialize(int width, int height, const char* windowName, const char* defaultTexturePath);
+    void Initialize(int width, int height, const char* windowName, const char* defaultTexturePath, bool enableAsyncCompute = false);
+
+    /*
+    * Initialize the diamond engine without a window
+    * 
+    * Sets up vulkan without glfw, a surface, or a swap chain. Frames are rendered into offscreen color images which can be read back
+    * with ReadbackFrame(), so this also runs on devices without presentation support such as software implementations (lavapipe)
+    * 
+    * @param width Width of the offscreen render target
+    * @param height Height of the offscreen render target
+    * @param applicationName Name of the vulkan application
+    * @param defaultTexturePath The path to the default texture the engine will fallback to in the case of a missing texture
+    * @param enableAsyncCompute See Initialize()
+    * @note IsRunning() always returns true, SetFullscreen() does nothing, and SetWindowSize() resizes the offscreen target
+    * @see ReadbackFrame()
+    */
+    void InitializeHeadless(int width, int height, const char* applicationName, const char* defaultTexturePath, bool enableAsyncCompute = false);
+
+    /*
+    * Copy the most recently rendered headless frame to host memory
+    * 
+    * Blocks until that frame has finished rendering
+    * 
+    * @param destination Memory of at least width * height * 4 bytes which receives the tightly packed R8G8B8A8 (sRGB) pixels, top row first
+    * @warning Only valid after InitializeHeadless() and at least one EndFrame()
+    */
+    void ReadbackFrame(void* destination);
 
     /*
     * Called at the start of every frame in the game loop
@@ -75,30 +105,210 @@ public:
     /*
     * Register a texture to the internal texture array
     * 
-    * Any texture that needs to be used must be registered to the array. After all desired textures are registered,
-    * call SyncTextureUpdates() to commit changes. All register commands return the id of the registered texture,
-    * which is used later when calling functions like Draw()
+    * Any texture that needs to be used must be registered to the array. Textures are stored in a fixed size bindless table, so
+    * registering one only writes its descriptor and it can be drawn with right away, even in the middle of a frame. All register
+    * commands return the id of the registered texture, which is used later when calling functions like Draw()
     * 
     * @param filePath The filepath of the texture image to load
     * @param data The raw pixel data of the image. Data will not be freed automatically
     * @param width The width of the image
     * @param height The height of the image
+    * @param format The uncompressed format of data, R8G8B8A8_SRGB when not given. Single channel formats sample as white with the
+    * channel in alpha, which suits masks and font atlases
     * @returns The id of the registered texture to be used later
-    * @note Currently, there is no way to unregister a texture once it is registered
-    * @see SyncTextureUpdates()
+    * @warning At most MAX_TEXTURES textures can be registered at once, or fewer if the device supports less
+    * @see GetTextureUploadHandle() UnregisterTexture()
     */
     uint32_t RegisterTexture(const char* filePath);
     uint32_t RegisterTexture(void* data, int width, int height);
+    uint32_t RegisterTexture(void* data, int width, int height, VkFormat format);
+
+    /*
+    * Register a block compressed texture from a KTX2 or DDS file
+    *
+    * The data is uploaded as is along with the mip levels stored in the file, so nothing is decoded on the cpu
+    *
+    * @param filePath The filepath of the .ktx2 or .dds file
+    * @returns The id of the registered texture to be used later
+    * @note KTX2 files must not be supercompressed, and DDS files must hold a BC format. DDS files without a DX10 header are assumed
+    * to hold srgb color, use the DX10 header to store linear BC1-3 data
+    * @warning The format of the file must pass IsTextureFormatSupported()
+    * @see RegisterTexture()
+    */
+    uint32_t RegisterCompressedTexture(const char* filePath);
 
     /*
-    * Apply changes made to the registered texture array
+    * Check if textures of a format can be registered on this device
+    *
+    * @param format The format to check
+    * @returns true if the engine knows the format and the device can sample it
+    * @see RegisterTexture() RegisterCompressedTexture()
+    */
+    bool IsTextureFormatSupported(VkFormat format);
+
+    /*
+    * Register a texture which is loaded in the background
     * 
-    * Call this after all registrations have been made. It can be called multiple times, but every call recreates many parts of
-    * the vulkan pipeline and will likely cause performance issues
+    * The image is decoded on a pool of worker threads and then uploaded along with the other pending uploads. The returned id
+    * can be used right away, and draws with it show the default texture until the image is resident. This is preferable to
+    * RegisterTexture() when loading many textures at once, since decoding is spread over every core
     * 
-    * @see RegisterTexture()
+    * @param filePath The filepath of the texture image to load
+    * @returns The id of the registered texture to be used later
+    * @note If the file is missing or can't be decoded, the texture keeps showing the default texture, see HasTextureLoadFailed()
+    * @see IsTextureResident() RegisterTexture()
+    */
+    uint32_t RegisterTextureAsync(const char* filePath);
+
+    /*
+    * Destroy a registered texture and free its slot for the next registration
+    *
+    * The texture is released once the frames in flight and its pending upload are done with it, and any load still in progress is
+    * dropped. Ids carry the generation of their slot, so passing the id of a destroyed texture to the engine asserts even after
+    * the slot has been reused
+    *
+    * @param textureId The id returned when the texture was registered
+    * @note The images of compute pipelines are destroyed along with the pipeline instead
+    * @see RegisterTexture() GetTextureSlot()
+    */
+    void UnregisterTexture(uint32_t textureId);
+
+    /*
+    * Get the slot of a texture in the bindless texture table, which is the index shaders sample it with
+    *
+    * The slot equals the id until a texture reuses the slot of an unregistered one. Draw functions which take a texture index
+    * convert it already, so this is only needed for texture indices written to custom vertex data or push constants
+    *
+    * @param textureId The id returned when the texture was registered
+    * @returns The index of the texture in the texture table
+    * @see UnregisterTexture() diamond_vertex
+    */
+    uint32_t GetTextureSlot(uint32_t textureId);
+
+    /*
+    * Check whether an asynchronously registered texture has finished loading
+    * 
+    * @param textureId The id returned when the texture was registered
+    * @returns true once draws with the texture show its own image, which is always the case for synchronously registered textures
+    * unless they have been evicted
+    * @see RegisterTextureAsync() SetTextureMemoryBudget()
+    */
+    bool IsTextureResident(uint32_t textureId);
+
+    /*
+    * Check whether the file of an asynchronously loaded texture couldn't be read
+    *
+    * Failed textures keep showing the default texture and are not loaded again. They can be unregistered like any other texture
+    *
+    * @param textureId The id returned when the texture was registered
+    * @returns true if the load failed
+    * @see RegisterTextureAsync() IsTextureResident()
+    */
+    bool HasTextureLoadFailed(uint32_t textureId);
+
+    /*
+    * Limit the device memory used by textures
+    *
+    * Once the budget is exceeded, the textures which have gone unused the longest are evicted at the start of each frame until usage
+    * is back under it. Evicted textures keep their id and show the default texture, and drawing with one streams it back in on the
+    * worker threads used by RegisterTextureAsync()
+    *
+    * @param budget The budget in bytes, 0 for no limit which is the default
+    * @note Only textures registered from a file can be evicted, and textures drawn with in the previous frame are always kept, so
+    * usage can stay above the budget
+    * @see GetTextureMemoryUsage() MarkTextureUsed()
+    */
+    void SetTextureMemoryBudget(uint64_t budget);
+
+    /*
+    * Get the device memory currently used by textures
+    *
+    * @returns The combined size in bytes of every resident texture, including compute images
+    * @see SetTextureMemoryBudget()
+    */
+    uint64_t GetTextureMemoryUsage();
+
+    /*
+    * Keep a texture from being evicted, and stream it back in if it was
+    *
+    * Draw functions which take a texture index already do this, so it is only needed for textures which are referenced through
+    * custom vertex data or push constants. Can be called from recording threads
+    *
+    * @param textureId The id of the texture which is being drawn with this frame
+    * @see SetTextureMemoryBudget()
+    */
+    void MarkTextureUsed(uint32_t textureId);
+
+    /*
+    * Pack many small images into as few atlas textures as possible
+    * 
+    * Each atlas page is registered as a regular texture. Drawing sprites from a shared page instead of from individual textures
+    * keeps the texture cache warm and the texture table small. The pages are packed with stb_rect_pack, and the padding around
+    * every image repeats its edge pixels so that linear filtering does not bleed neighbouring images in
+    * 
+    * Mip texels average several pixels of the page, so the pages only get as many mips as the padding can keep apart: 1 + log2(padding)
+    * levels. A padding of 1 disables mipmapping, the default of 4 keeps the levels down to a quarter of the page size. Sprites which are
+    * drawn much smaller than that need a larger padding, at the cost of fewer images per page
+    * 
+    * @param images Array of images to pack
+    * @param filePaths Array of filepaths of the images to load and pack
+    * @param imageCount The amount of images in the array
+    * @param pageSize The width and maximum height of the atlas pages, clamped to the largest image size the device supports
+    * @param padding The amount of pixels between images
+    * @returns The page and texture coordinates of every image, in the same order as they were passed in
+    * @warning Every image must fit into a single page including its padding
+    * @see diamond_atlas_entry DrawQuad() DrawQuadsTransform()
+    */
+    std::vector<diamond_atlas_entry> BuildTextureAtlas(const diamond_atlas_image* images, uint32_t imageCount, uint32_t pageSize = 2048, uint32_t padding = 4);
+    std::vector<diamond_atlas_entry> BuildTextureAtlas(const char** filePaths, uint32_t imageCount, uint32_t pageSize = 2048, uint32_t padding = 4);
+
+    /*
+    * Submit the pixel data of the textures registered so far
+    * 
+    * Registered textures no longer need to be committed, so calling this is optional. It is kept for compatibility and behaves
+    * like FlushUploads()
+    * 
+    * @see RegisterTexture() FlushUploads()
     */
     void SyncTextureUpdates();
+
+    /*
+    * Get the upload handle of a registered texture
+    *
+    * Registering a texture only records the copy of its pixel data, which then runs on a dedicated transfer queue when the
+    * device has one. Frames which draw the texture wait on the copy, so waiting for the handle first keeps them from stalling
+    *
+    * @param textureId The id returned when the texture was registered
+    * @returns A handle which can be passed to IsUploadComplete() or WaitForUpload()
+    * @note Textures registered with RegisterTextureAsync() only get a handle once they are decoded, see IsTextureResident() instead
+    * @see RegisterTexture() FlushUploads()
+    */
+    uint64_t GetTextureUploadHandle(uint32_t textureId);
+
+    /*
+    * Submit every upload recorded so far
+    *
+    * Pending uploads are otherwise submitted at the end of every frame and by SyncTextureUpdates()
+    *
+    * @returns A handle which completes once all of these uploads have finished
+    */
+    uint64_t FlushUploads();
+
+    /*
+    * Check whether an upload has finished without blocking
+    *
+    * @param uploadHandle A handle returned by FlushUploads() or GetTextureUploadHandle()
+    * @returns true once the data is on the gpu
+    * @note Uploads which have not been submitted yet never complete, see FlushUploads()
+    */
+    bool IsUploadComplete(uint64_t uploadHandle);
+
+    /*
+    * Block until an upload has finished, submitting it first if needed
+    *
+    * @param uploadHandle A handle returned by FlushUploads() or GetTextureUploadHandle()
+    */
+    void WaitForUpload(uint64_t uploadHandle);
     
     /*
     * Create a pipeline which specifies the shaders and information layouts to use during the following draw calls
@@ -122,6 +332,18 @@ public:
     */
     void DeleteGraphicsPipeline(int pipelineIndex);
 
+    /*
+    * Get how much geometry is bound to a graphics pipeline per frame
+    *
+    * The vertex and index buffers of a pipeline start out at maxVertexCount and maxIndexCount per frame in flight and double
+    * whenever a frame binds more than fits. The peak counts can be used to pick initial sizes which avoid growing at runtime
+    *
+    * @param pipelineIndex The index of the graphics pipeline
+    * @returns The amounts claimed by the previous frame and the highest amounts claimed by any frame so far
+    * @see diamond_geometry_usage diamond_graphics_pipeline_create_info
+    */
+    diamond_geometry_usage GetGeometryUsage(int pipelineIndex);
+
     /*
     * Create a pipeline which enables the use of powerful vulkan compute shaders
     *
@@ -138,7 +360,7 @@ public:
     /*
     * Delete a compute pipeline via its index
     *
-    * The id of the old pipeline never gets reused nor does the associated image texture indexes
+    * The index of the old pipeline gets reused by the next pipeline, and the texture slots of its images are freed
     * 
     * @param pipelineIndex The index of the compute pipeline
     * @see CreateComputePipeline()
@@ -149,7 +371,7 @@ public:
     * Map data to a compute pipeline buffer to be accessed in the shader
     *
     * Can be called any time. When a buffer is flagged as staging, the data must also be uploaded after it is mapped in order
-    * for the changes to propogate to the GPU memory
+    * for the changes to propogate to the GPU memory. Since frames are pipelined, the GPU may still be reading the buffer from a previous frame
     * 
     * @param pipelineIndex The index of the compute pipeline
     * @param bufferIndex The index local to this specific pipeline of the destination buffer
@@ -190,8 +412,8 @@ public:
     /*
     * Transfer buffer data stored on the GPU to a local staging buffer 
     *
-    * Must be called between begin and end frame. The operation completes at the end of the frame, which means that retrieval
-    * must occur during the next frame in order to retrieve accurate data
+    * Must be called between begin and end frame. The operation completes once the GPU has finished the frame. Since frames are pipelined,
+    * this is only guaranteed once the same frame slot comes around again, which means that retrieval must occur at least two frames later in order to retrieve accurate data
     * 
     * @param pipelineIndex The index of the compute pipeline
     * @param bufferIndex The index local to this specific pipeline of the buffer to download
@@ -202,7 +424,8 @@ public:
     /*
     * Run the specified compute shader
     *
-    * Will run using whatever data is currently bound and will not move on until it is completed
+    * Will run using whatever data is currently bound. The results are visible to any following compute shaders and to every draw call made
+    * during the same frame
     * 
     * @param pipelineIndex The index of the compute pipeline
     * @param pushConstantsData A pointer to the data which should be bound to the push constants for this execution (if usePushConstants is set)
@@ -219,12 +442,55 @@ public:
     */
     void SetGraphicsPipeline(int pipelineIndex);
 
+    /*
+    * Create a context which lets another thread record draw calls in parallel to the main thread
+    *
+    * Every context owns a command pool and secondary command buffer per frame in flight and claims geometry memory from the pipelines
+    * in chunks, so recording into it never contends with other threads. Must not be called while any context is recording
+    * 
+    * @param order Contexts are executed after the draw calls made on the main thread in ascending order, with ties going to the context
+    * created first. ImGui is always drawn last
+    * @returns The index of the context for future referencing
+    * @see BeginRecording()
+    */
+    int CreateRecordingContext(int order = 0);
+
+    /*
+    * Delete a recording context via its index
+    * 
+    * @param contextIndex The index of the recording context
+    * @see CreateRecordingContext()
+    */
+    void DeleteRecordingContext(int contextIndex);
+
+    /*
+    * Bind a recording context to the calling thread
+    *
+    * Call between BeginFrame() and EndFrame(). Until EndRecording() is called, every draw related call made on this thread (SetGraphicsPipeline(),
+    * BindVertices(), Draw(), DrawQuad() etc.) records into the context instead of the main command buffer. A context starts every frame without a
+    * bound pipeline and can only be recorded by one thread at a time
+    * 
+    * @param contextIndex The index of the recording context
+    * @warning Creating or deleting pipelines, contexts and textures while any context is recording is not thread safe
+    * @see EndRecording()
+    */
+    void BeginRecording(int contextIndex);
+
+    /*
+    * Finish recording the context bound to the calling thread
+    *
+    * Must be called on the same thread as BeginRecording() and before EndFrame(), which then executes the recorded commands
+    * 
+    * @see BeginRecording()
+    */
+    void EndRecording();
+
     /*
     * Get the texture index of the specified image bound to the specified compute pipeline
     * 
     * @param pipelineIndex The index of the compute pipeline
     * @param imageIndex The index local to this specific pipeline of the image to get the associated texture index
-    * @returns 
+    * @returns The texture id of the image, or -1 if the pipeline has no images
     */
     int GetComputeTextureIndex(int pipelineIndex, int imageIndex);
 
@@ -268,13 +534,49 @@ public:
     * This can be called any number of times during a frame. Call it right before a DrawIndexed() call is made
     * and it can be called again immediately after for a different set of indices if necessary.
     * 
+    * 16 bit indices can be bound to any pipeline, while 32 bit indices require a pipeline created with VK_INDEX_TYPE_UINT32
+    * 
     * @param indices An array of vertex indices
     * @param index The amount of indices passed in the array
     * @note See https://www.proofof.blog/2018/09/24/vertex-and-index-buffer.html for information on indexed drawing
-    * @see Draw() DrawIndexed()
+    * @see Draw() DrawIndexed() diamond_graphics_pipeline_create_info
     */
     void BindIndices(const uint16_t* indices, uint32_t indexCount);
     void BindIndices(uint16_t* indices, uint32_t indexCount);
+    void BindIndices(const uint32_t* indices, uint32_t indexCount);
+    void BindIndices(uint32_t* indices, uint32_t indexCount);
+
+    /*
+    * Reserve space for vertices in the currently bound pipeline and get a pointer to write them to directly
+    * 
+    * Works exactly like BindVertices() except that the vertices are not copied from a temporary array. Instead, the returned memory
+    * is GPU visible and the vertices should be written to it exactly once before the next draw call that uses them. The pointer is only
+    * valid until EndFrame() is called
+    * 
+    * @param vertexCount The amount of vertices to reserve
+    * @returns A pointer to vertexCount vertices matching the layout defined in the pipeline, or nullptr if no pipeline is bound
+    * @note The memory is write combined, so write it sequentially and never read from it
+    * @see BindVertices() Draw() DrawIndexed()
+    */
+    void* ReserveVertices(uint32_t vertexCount);
+    template <typename T>
+    inline T* ReserveVertices(uint32_t vertexCount) { return static_cast<T*>(ReserveVertices(vertexCount)); };
+
+    /*
+    * Reserve space for indices in the currently bound pipeline and get a pointer to write them to directly
+    * 
+    * Works exactly like BindIndices() except that the indices are not copied from a temporary array. Indices are relative to the
+    * first vertex of the vertices that are drawn alongside them
+    * 
+    * The first version is for pipelines with 16 bit indices and the second one for pipelines with 32 bit indices
+    * 
+    * @param indexCount The amount of indices to reserve
+    * @returns A pointer to indexCount indices, or nullptr if no pipeline is bound
+    * @note The memory is write combined, so write it sequentially and never read from it
+    * @see ReserveVertices() BindIndices() DrawIndexed()
+    */
+    uint16_t* ReserveIndices(uint32_t indexCount);
+    uint32_t* ReserveIndices32(uint32_t indexCount);
 
     /*
     * Draw the currently bound vertices to the screen using the currently bound pipeline
@@ -330,6 +632,48 @@ public:
     */
     void DrawFromCompute(int pipelineIndex, int bufferIndex, uint32_t vertexCount); // This will use the currently bound graphics pipeline, but draw vertices from a compute shader buffer
 
+    /*
+    * Upload geometry which never changes to device local memory once so that it can be drawn in any later frame
+    *
+    * Unlike BindVertices(), the data does not have to be provided again every frame. The upload runs asynchronously and
+    * the first frame drawing the mesh waits for it on the gpu
+    *
+    * @param vertices Array of vertices in the layout of the pipelines the mesh will be drawn with
+    * @param vertexCount The amount of vertices in the array
+    * @param vertexSize The size of a single vertex in bytes
+    * @param indices Optional array of 16 or 32 bit indices into the vertices
+    * @param indexCount The amount of indices in the array
+    * @returns The index of the mesh for future referencing
+    * @see DrawStaticMesh() DeleteStaticMesh()
+    */
+    int CreateStaticMesh(const void* vertices, uint32_t vertexCount, uint32_t vertexSize, const uint16_t* indices = nullptr, uint32_t indexCount = 0);
+    int CreateStaticMesh(const void* vertices, uint32_t vertexCount, uint32_t vertexSize, const uint32_t* indices, uint32_t indexCount);
+
+    /*
+    * Delete a static mesh via its index
+    *
+    * Frames which are still in flight can keep drawing it, and the index may be reused by later meshes
+    *
+    * @param meshIndex The index of the mesh
+    * @see CreateStaticMesh()
+    */
+    void DeleteStaticMesh(int meshIndex);
+
+    /*
+    * Draw a static mesh to the screen using the currently bound pipeline
+    *
+    * This can be called any number of times during a frame. Meshes with indices are drawn indexed. The second override
+    * assumes the pipeline has useCustomPushConstants set to false, like Draw()
+    *
+    * @param meshIndex The index of the mesh
+    * @param pushConstantsData A pointer to the data which should be pushed for this object, which means useCustomPushConstants must be true and the layout must match the one specified in the pipeline
+    * @param textureIndex The index of the desired texture for this object that will be passed through to the shader
+    * @param objectTransform The world space transform of the object that is being drawn that will be passed through to the shader
+    * @see CreateStaticMesh() diamond_transform diamond_object_data
+    */
+    void DrawStaticMesh(int meshIndex, void* pushConstantsData);
+    void DrawStaticMesh(int meshIndex, int textureIndex, diamond_transform objectTransform);
+
     /*
     * Draw a quad to the screen with a given transform
     * 
@@ -370,7 +714,8 @@ public:
     * This can be called any number of times during a frame. There is no need to call BindVertices() or BindIndices(), as
     * this function handles the geometry for you. This function produces the same results as DrawQuadsOffsetScale(), but
     * has a significant performance hit when rendering large amounts of quads. The advantage of this implementation is that
-    * the data is provided in transforms which are organized and have support for rotation.
+    * the data is provided in transforms which are organized and have support for rotation. Any amount of quads can be drawn
+    * at once, but pipelines with 16 bit indices split them into one draw per 16384 quads
     * 
     * @param textureIndexes Array of indexes of registered textures that will be drawn on each quad. Pass a -1 to any element to render only color
     * @param quadTransforms Array of world space transforms of each quad
@@ -389,7 +734,8 @@ public:
     * This can be called any number of times during a frame. There is no need to call BindVertices() or BindIndices(), as
     * this function handles the geometry for you. This function produces the same results as DrawQuadsTransform(), but
     * has significantly better performance when rendering large amounts of quads. The disadvantage of this implementation is that
-    * there is no support for rotation of the quads individually
+    * there is no support for rotation of the quads individually. Any amount of quads can be drawn at once, but pipelines with
+    * 16 bit indices split them into one draw per 16384 quads
     * 
     * @param textureIndexes Array of indexes of registered textures that will be drawn on each quad. Pass a -1 to any element to render only color
     * @param offsetScales Array of vec4 that represents the offset (x, y) and scale (z, w) of each quad
@@ -422,7 +768,7 @@ public:
     * 
     * Used as the condition in the while() game loop
     * 
-    * @returns true if the engine is running and the window is still open
+    * @returns true if the engine is running and the window is still open (always true when headless)
     */
     bool IsRunning();
 
@@ -475,6 +821,79 @@ public:
     */
     inline double FPS() { return fps; };
 
+    /*
+    * Begin a named scope which is timed on the GPU
+    * 
+    * Everything recorded into the calling thread's recording context until the matching EndGpuScope() is bracketed with timestamp queries.
+    * Scopes can be nested. Compute dispatches, the main render pass and the ImGui overlay are always timed
+    * 
+    * @param name The name the timing is reported under
+    * @note Scopes past the per frame query budget are silently dropped
+    * @see GetGpuTimings()
+    */
+    void BeginGpuScope(const char* name);
+
+    /*
+    * End the scope most recently begun by BeginGpuScope() on the calling thread's recording context
+    */
+    void EndGpuScope();
+
+    /*
+    * Get the GPU timings of the most recent frame which finished executing
+    * 
+    * Queries are resolved once BeginFrame() has waited on the frame which recorded them, so they trail the current frame by
+    * MAX_FRAMES_IN_FLIGHT frames but reading them never stalls
+    * 
+    * @returns The timings in the order their scopes were begun
+    * @see diamond_gpu_timing
+    */
+    inline const std::vector<diamond_gpu_timing>& GetGpuTimings() { return gpuTimings; };
+
+    /*
+    * Same as FrameDelta() except measured on the GPU over the main render pass using the most recently resolved timings
+    *
+    * @returns The time in milliseconds
+    * @see GetGpuTimings()
+    */
+    inline double GpuFrameDelta() { return gpuFrameDelta; };
+
+    /*
+    * Configure the frame statistics returned by GetFrameStats()
+    * 
+    * Clears the statistics gathered so far. Defaults to a window of 600 frames and a budget of 1000 / 60 milliseconds
+    * 
+    * @param windowSize The number of most recent frames the statistics cover
+    * @param hitchBudget Frames taking longer than this many milliseconds are counted as hitches
+    */
+    void ConfigureFrameStats(int windowSize, double hitchBudget);
+
+    /*
+    * Get the distribution of the CPU frame time, present interval and GPU frame time over the most recent frames
+    * 
+    * Unlike FrameDelta() nothing is trimmed, so the percentiles and maximum show the tail latency. Percentiles are
+    * accurate to 0.1 milliseconds up to 200 milliseconds
+    * 
+    * @returns The current statistics
+    * @see ConfigureFrameStats()
+    */
+    diamond_frame_stats GetFrameStats();
+
+    #if DIAMOND_IMGUI
+    /*
+    * Draws an ImGui window with the statistics from GetFrameStats() and a plot of the recent CPU frame times
+    * 
+    * @note Must be called between BeginFrame() and EndFrame()
+    */
+    void DrawFrameStats();
+
+    /*
+    * Draws an ImGui window listing the most recently resolved GPU timings
+    * 
+    * @note Must be called between BeginFrame() and EndFrame()
+    */
+    void DrawGpuProfiler();
+    #endif
+
     /*
     * Get the glfw window handle
     * 
@@ -499,12 +918,12 @@ public:
     /*
     * Get the set of vulkan components used during rendering
     * 
-    * This exposes two vulkan components for outside use: the main render pass, the command buffer used during the main render pass
+    * This exposes two vulkan components for outside use: the main render pass, the command buffer used during the main render pass of the current frame
     * 
     * @returns A tuple of the two components (VkRenderPass, VkCommandBuffer)
     * @warning Utilizing these handles may result in undefined behavior
     */
-    inline std::tuple<VkRenderPass, VkCommandBuffer> VulkanRenderComponents() { return std::make_tuple(renderPass, renderPassBuffer); };
+    inline std::tuple<VkRenderPass, VkCommandBuffer> VulkanRenderComponents() { return std::make_tuple(renderPass, mainContext.commandBuffers[currentFrameIndex]); };
 
     /*
     * Get the vulkan swap chain tied to the engine window
@@ -542,27 +961,42 @@ private:
     void CreateComputePipeline(diamond_compute_pipeline& pipeline);
     void CreateRenderPass();
     void CreateSwapChain();
+    void CreateOffscreenTargets();
     void CreateFrameBuffers();
-    void CreateCommandBuffers();
+    void CreateFrameCommandBuffers();
     void RecreateSwapChain();
     void RecreateCompute(diamond_compute_pipeline& pipeline, diamond_compute_pipeline_create_info createInfo);
     void CleanupSwapChain();
     void CleanupCompute(diamond_compute_pipeline& pipeline);
     void CleanupGraphics(diamond_graphics_pipeline& pipeline);
-    void CreateVertexBuffer(int vertexSize, int maxVertexCount, VkBuffer& vertexBuffer, VkDeviceMemory& vertexBufferMemory);
-    void CreateIndexBuffer(int maxIndexCount, VkBuffer& indexBuffer, VkDeviceMemory& indexBufferMemory);
+    void CreateStreamBuffer(VkDeviceSize size, VkBufferUsageFlags usage, diamond_stream_buffer& stream);
+    void CleanupStreamBuffer(diamond_stream_buffer& stream);
+    void BeginStreamFrame(diamond_stream_buffer& stream);
+    void GrowStreamBuffer(diamond_stream_buffer& stream, VkDeviceSize size, VkDeviceSize alignment);
+    VkDeviceSize AllocateStreamMemory(diamond_stream_buffer& stream, VkDeviceSize size, VkDeviceSize alignment);
+    VkDeviceSize AllocateContextStreamMemory(diamond_recording_context& context, diamond_stream_buffer& stream, diamond_stream_chunk& chunk, VkDeviceSize size, VkDeviceSize alignment);
+    diamond_recording_context& CurrentContext();
+    void BeginRenderPassBuffer(VkCommandBuffer buffer);
+    void ResetContextGeometry(diamond_recording_context& context);
     void CreateDescriptorSetLayout();
     void CreateComputeDescriptorSetLayout(diamond_compute_pipeline& pipeline, int bufferCount, int imageCount);
     void CreateUniformBuffers();
-    void UpdatePerFrameBuffer(uint32_t imageIndex);
+    void UpdatePerFrameBuffer(int frameIndex);
     void CreateDescriptorPool();
     void CreateComputeDescriptorPool(diamond_compute_pipeline& pipeline, int bufferCount, int imageCount);
     void CreateDescriptorSets();
+    void QueueTextureDescriptorWrite(uint32_t textureId);
+    void FlushTextureDescriptorWrites(int frameIndex);
     void CreateComputeDescriptorSets(diamond_compute_pipeline& pipeline, int bufferCount, int imageCount, diamond_compute_buffer_info* bufferInfo);
     void CreateTextureSampler();
     void CreateColorResources();
     void CreateDepthResources();
     void Present();
+    bool IsComputeBufferDoubleBuffered(const diamond_compute_buffer_info& bufferInfo);
+    VkBuffer GetComputeDeviceBuffer(const diamond_compute_pipeline& pipeline, int bufferIndex, int frameIndex);
+    void CarryOverComputeBuffers();
+    void GetSharedComputeResources(std::vector<VkBuffer>& buffers, std::vector<VkImage>& images);
+    void TransferComputeOwnership(VkCommandBuffer cmd, uint32_t srcQueueFamily, uint32_t dstQueueFamily, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask);
 
     #if DIAMOND_IMGUI
     void CleanupImGui();
@@ -580,19 +1014,68 @@ private:
     VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& presentModes);
     VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
     uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-    void MapMemory(void* data, uint32_t dataSize, uint32_t elementCount, VkDeviceMemory bufferMemory, uint32_t elementMemoryOffset);
-    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    void MapMemory(void* data, uint32_t dataSize, uint32_t elementCount, const diamond_allocation& bufferMemory, uint32_t elementMemoryOffset);
+    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, diamond_allocation& bufferMemory, bool sharedWithCompute = false, bool transient = false);
+    diamond_allocation AllocateMemory(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties, bool optimalImage, bool transient);
+    void FreeMemory(diamond_allocation& allocation);
+    void CleanupMemoryPools();
+    void CreateUploadResources();
+    void CleanupUploadResources();
+    uint32_t AddTexture(diamond_texture& texture);
+    void ReleaseTextureSlot(uint32_t slot);
+    uint32_t MakeTextureHandle(uint32_t slot);
+    int UseTexture(int textureIndex);
+    void QueueTextureLoad(uint32_t textureId);
+    bool ReadCompressedTexture(diamond_texture_load& load);
+    void TextureLoadWorker();
+    void ProcessTextureLoads();
+    void UpdateTextureResidency();
+    void StopTextureLoads();
+    VkCommandBuffer GetUploadCommandBuffer();
+    VkDeviceSize StageUploadData(const void* data, VkDeviceSize size, VkBuffer& stagingBuffer);
+    void UploadBufferData(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+    void SubmitUploads();
+    void RetireUploadBatch(diamond_upload_batch& batch);
+    void WaitForUploads();
+    void ReleaseUploadedImage(VkCommandBuffer commandBuffer, VkImage image);
+    void ReleaseUploadedBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+    void AcquireUploads(VkCommandBuffer commandBuffer);
+    diamond_deferred_deletion& DeferredDeletion();
+    void CleanupStaticMesh(diamond_static_mesh& mesh);
+    void RecordStaticMeshDraw(diamond_recording_context& context, const diamond_static_mesh& mesh);
+    void RetireDeletions(bool all);
     void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    void CopyBufferToImage(VkBuffer srcBuffer, VkImage dstImage, uint32_t width, uint32_t height);
-    VkImageView CreateTextureImage(const char* imagePath, VkImage& image, VkDeviceMemory& imageMemory, int& width, int& height);
-    VkImageView CreateTextureImage(void* data, VkImage& image, VkDeviceMemory& imageMemory, int width, int height);
-    void CreateImage(uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED);
-    void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
-    VkImageView CreateImageView(VkImage image, VkFormat format, uint32_t mipLevels, VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT);
+    void CopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkDeviceSize srcOffset, VkImage dstImage, uint32_t width, uint32_t height, uint32_t mipLevel = 0);
+    VkImageView CreateTextureImage(const char* imagePath, VkImage& image, diamond_allocation& imageMemory, int& width, int& height);
+    VkImageView CreateTextureImage(void* data, VkImage& image, diamond_allocation& imageMemory, int width, int height, const std::vector<uint8_t>* mipChain = nullptr, VkFormat format = VK_FORMAT_R8G8B8A8_SRGB);
+    VkImageView CreateTextureImage(const void* const* levels, uint32_t mipLevels, VkFormat format, int width, int height, VkImage& image, diamond_allocation& imageMemory);
+    bool GetTextureFormatInfo(VkFormat format, uint32_t& blockExtent, uint32_t& blockSize);
+    VkDeviceSize GetTextureLevelSize(VkFormat format, int width, int height);
+    uint32_t GetMipLevelCount(int width, int height);
+    void GenerateMipChain(const uint8_t* pixels, int width, int height, VkFormat format, std::vector<uint8_t>& mipChain);
+    void GenerateComputeMips(VkCommandBuffer commandBuffer);
+    void CreateImage(uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, diamond_allocation& imageMemory, VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+    void TransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
+    VkImageView CreateImageView(VkImage image, VkFormat format, uint32_t mipLevels, VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT, VkComponentMapping components = {});
     glm::mat4 GenerateModelMatrix(diamond_transform objectTransform);
+    void WriteQuadIndices(void* destination, uint32_t quadIndex, VkIndexType indexType);
+    int GetQuadBatchSize(int quadCount);
+    void* ReserveIndexMemory(uint32_t indexCount);
+    VkDeviceSize GetIndexSize(VkIndexType indexType);
+    int CreateStaticMesh(const void* vertices, uint32_t vertexCount, uint32_t vertexSize, const void* indices, uint32_t indexCount, VkIndexType indexType);
     VkSampleCountFlagBits GetMaxSampleCount();
+    void CreateQueryPools();
+    int ReserveGpuScope(const char* name, int depth, bool compute, int computePipelineIndex = -1);
+    void WriteGpuTimestamp(VkCommandBuffer cmd, int scopeIndex, bool end);
+    void ResolveGpuTimings(int frameIndex);
+    void AddFrameSample(diamond_frame_histogram& histogram, double sample);
+    diamond_frame_timing_stats GetFrameTimingStats(const diamond_frame_histogram& histogram);
 
-    GLFWwindow* window;
+    GLFWwindow* window = nullptr;
+    bool headless = false;
+    VkExtent2D headlessExtent;
+    std::vector<diamond_allocation> offscreenImagesMemory;
+    int lastRenderedImageIndex = -1;
 
     std::array<double, 11> deltaTimes;
     int frameCount = 0;
@@ -604,6 +1087,11 @@ private:
     std::vector<const char*> validationLayers = {};
     std::vector<const char*> deviceExtensions = {};
     const int MAX_FRAMES_IN_FLIGHT = 2;
+    const int STREAM_CHUNKS_PER_FRAME = 32; // granularity at which recording contexts claim stream memory
+    const uint32_t MAX_TEXTURES = 4096; // size of the bindless texture table
+    uint32_t textureCapacity = 0; // MAX_TEXTURES clamped to the device limits
+    const uint32_t TEXTURE_SLOT_BITS = 16; // texture ids hold the slot in the low bits and its generation above them
+    const uint32_t MAX_TEXTURE_GENERATION = 0x7FFF; // keeps ids positive when passed as draw texture indices
     int currentFrameIndex = 0;
     uint32_t nextImageIndex = 0;
     bool shouldPresent = true;
@@ -612,8 +1100,6 @@ private:
     glm::mat4 cameraProjMatrix;
     glm::vec2 cameraDimensions = { 500.f, 500.f };
     int savedWindowSizeAndPos[4]; // size xy, pos xy
-    std::vector<diamond_vertex> quadVertices;
-    std::vector<uint16_t> quadIndices;
     VkPhysicalDeviceProperties physicalDeviceProperties;
 
     VkInstance instance = VK_NULL_HANDLE;
@@ -622,14 +1108,24 @@ private:
     VkQueue graphicsQueue = VK_NULL_HANDLE;
     VkQueue presentQueue = VK_NULL_HANDLE;
     VkQueue computeQueue = VK_NULL_HANDLE;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    diamond_queue_family_indices queueFamilies = {};
     VkSurfaceKHR surface = VK_NULL_HANDLE;
     VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
     VkRenderPass renderPass = VK_NULL_HANDLE;
     VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
     VkCommandPool commandPool = VK_NULL_HANDLE;
     VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    #if DIAMOND_IMGUI
+    VkDescriptorPool imguiDescriptorPool = VK_NULL_HANDLE; // separate since the main pool only allocates update after bind sets
+    #endif
+    std::vector<diamond_deferred_deletion> deferredDeletions; // oldest first
+    std::vector<diamond_static_mesh> staticMeshes;
+    std::vector<VkCommandPool> frameCommandPools = {};
     std::vector<VkCommandBuffer> commandBuffers = {};
-    VkCommandBuffer renderPassBuffer = {};
+    #if DIAMOND_IMGUI
+    std::vector<VkCommandBuffer> overlayBuffers = {}; // ImGui is recorded separately so it ends up on top of every recording context
+    #endif
     std::vector<VkSemaphore> imageAvailableSemaphores = {};
     std::vector<VkSemaphore> renderFinishedSemaphores = {};
     std::vector<VkFence> inFlightFences = {};
@@ -637,25 +1133,90 @@ private:
     std::vector<VkDescriptorSet> descriptorSets;
     VkSampler textureSampler;
     std::vector<diamond_texture> textureArray = {};
+    std::vector<uint32_t> freeTextureSlots; // slots of unregistered textures, reused before the array grows
+    std::vector<std::vector<uint32_t>> pendingTextureWrites; // texture descriptors which still have to be written to each frame's set
+    std::vector<std::thread> textureLoadThreads; // started by the first asynchronous registration
+    std::mutex textureLoadMutex; // guards the queued and decoded loads
+    std::condition_variable textureLoadCondition;
+    std::deque<diamond_texture_load> queuedTextureLoads;
+    std::vector<diamond_texture_load> decodedTextureLoads; // waiting for the main thread to upload them
+    std::vector<uint32_t> uploadingTextures; // waiting for their upload to complete
+    bool stopTextureLoads = false;
+    std::vector<std::atomic<uint64_t>> textureLastUsed; // graphics timeline value of the last frame which drew with each texture
+    uint64_t textureMemoryBudget = 0;
     VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
     VkImage colorImage;
-    VkDeviceMemory colorImageMemory;
+    diamond_allocation colorImageMemory;
     VkImageView colorImageView;
     VkImage depthImage;
-    VkDeviceMemory depthImageMemory;
+    diamond_allocation depthImageMemory;
     VkImageView depthImageView;
     std::vector<VkBuffer> uniformBuffers;
-    std::vector<VkDeviceMemory> uniformBuffersMemory;
+    std::vector<diamond_allocation> uniformBuffersMemory;
+
+    // memory
+    const VkDeviceSize MEMORY_BLOCK_SIZE = 64 * 1024 * 1024; // allocations above half of this get their own memory
+    const VkDeviceSize MIN_ALLOCATION_SIZE = 256; // smallest buddy of long lived pools
+    std::vector<diamond_memory_pool> memoryPools;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    std::mutex allocatorMutex;
+
+    // uploads
+    const VkDeviceSize UPLOAD_STAGING_SIZE = 32 * 1024 * 1024;
+    const int UPLOAD_BATCH_COUNT = 3;
+    diamond_stream_buffer uploadStaging;
+    std::vector<diamond_upload_batch> uploadBatches;
+    int currentUploadBatch = 0; // batch new uploads are recorded into, the ones after it are progressively older
+    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+    VkSemaphore uploadTimeline = VK_NULL_HANDLE;
+    uint64_t uploadTimelineValue = 0; // last value handed out to a batch
+    uint64_t uploadWaitValue = 0; // graphics submissions wait on this to use the resources they acquired
+    std::vector<diamond_upload_acquire> pendingAcquires;
     
     // compute
     std::vector<diamond_compute_pipeline> computePipelines;
-    VkFence computeFence = VK_NULL_HANDLE;
-    VkCommandBuffer computeBuffer = {};
+    std::vector<VkCommandPool> computeCommandPools = {};
+    std::vector<VkCommandBuffer> computeBuffers = {};
+    VkSemaphore computeTimeline = VK_NULL_HANDLE;
+    uint64_t computeTimelineValue = 0;
+    std::vector<uint64_t> computeFrameValues = {}; // timeline value signaled by the compute submission of each frame in flight
+    VkSemaphore graphicsTimeline = VK_NULL_HANDLE;
+    uint64_t graphicsTimelineValue = 0;
+    bool computeDispatched = false;
+    bool asyncCompute = false;
+    std::vector<VkBuffer> ownershipBuffers; // compute resources handed between queue families every frame
+    std::vector<VkImage> ownershipImages;
+    bool ownershipReleased = false;
     std::vector<const char*> freedBuffers;
 
     // graphics
     std::vector<diamond_graphics_pipeline> graphicsPipelines;
-    int boundGraphicsPipelineIndex = -1;
+    diamond_recording_context mainContext;
+    std::vector<diamond_recording_context> recordingContexts;
+    static thread_local int threadContextIndex; // recording context bound to the calling thread, -1 for the main context
+    std::mutex streamMutex;
+
+    // profiling
+    const uint32_t MAX_GPU_TIMESTAMPS = 256; // per query pool and frame in flight
+    std::vector<VkQueryPool> graphicsQueryPools = {};
+    std::vector<VkQueryPool> computeQueryPools = {};
+    std::vector<std::vector<diamond_gpu_scope>> gpuScopes; // scopes recorded by each frame in flight
+    std::vector<uint32_t> graphicsQueryCounts;
+    std::vector<uint32_t> computeQueryCounts;
+    std::vector<bool> graphicsQueriesSubmitted; // the primary buffer which resets the graphics queries was not submitted when the swap chain was out of date
+    uint64_t graphicsTimestampMask = 0; // zero when the queue family does not support timestamps
+    uint64_t computeTimestampMask = 0;
+    std::vector<int> renderPassScopes;
+    std::vector<diamond_gpu_timing> gpuTimings;
+    double gpuFrameDelta = 0.0;
+    std::mutex gpuScopeMutex;
+    const double FRAME_HISTOGRAM_BUCKET_WIDTH = 0.1; // milliseconds
+    const int FRAME_HISTOGRAM_BUCKET_COUNT = 2000;
+    diamond_frame_histogram cpuFrameTimes;
+    diamond_frame_histogram presentIntervals;
+    diamond_frame_histogram gpuFrameTimes;
+    double frameHitchBudget = 0.0;
+    std::chrono::steady_clock::time_point lastPresentTime;
 
     diamond_swap_chain_info swapChain;
 };
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+
+// CPU zone profiler. Zones are only recorded when the engine is built with DIAMOND_PROFILE defined, otherwise the macros
+// below compile to nothing and the profiler functions do nothing
+
+#if DIAMOND_PROFILE
+#define DIAMOND_PROFILE_CONCAT_INNER(a, b) a##b
+#define DIAMOND_PROFILE_CONCAT(a, b) DIAMOND_PROFILE_CONCAT_INNER(a, b)
+
+// Times the remainder of the enclosing scope
+// @param name The name the zone is reported under. Only the pointer is stored, so this must be a string literal or otherwise outlive the profiler
+#define DIAMOND_PROFILE_SCOPE(name) diamond_profile_zone DIAMOND_PROFILE_CONCAT(diamondProfileZone, __LINE__)(name)
+
+// Times the remainder of the enclosing function under the function's name
+#define DIAMOND_PROFILE_FUNCTION() DIAMOND_PROFILE_SCOPE(__FUNCTION__)
+#else
+#define DIAMOND_PROFILE_SCOPE(name)
+#define DIAMOND_PROFILE_FUNCTION()
+#endif
+
+// One completed zone
+struct diamond_profile_event
+{
+    const char* name = nullptr;
+    uint64_t start = 0; // nanoseconds since the profiler was first used
+    uint64_t end = 0;
+};
+
+// Global access to the zones recorded by every thread
+class diamond_profiler
+{
+public:
+
+    /*
+    * Name the calling thread in exported traces
+    *
+    * @param name The name of the thread. Only the pointer is stored
+    */
+    static void SetThreadName(const char* name);
+
+    /*
+    * Write every zone still held in the per thread buffers to a file in the Chrome trace event format
+    *
+    * The file can be opened in chrome://tracing or https://ui.perfetto.dev
+    *
+    * @param filePath The path of the json file to write
+    * @returns true if the file was written
+    * @note Each thread keeps only its most recent MAX_EVENTS_PER_THREAD zones. Zones which are overwritten while exporting are skipped
+    */
+    static bool ExportChromeTrace(const char* filePath);
+
+    /*
+    * Drop every zone recorded so far
+    *
+    * @warning No other thread may be recording zones while this is called
+    */
+    static void Clear();
+
+    // Internal use
+    static void RecordEvent(const char* name, uint64_t start, uint64_t end);
+    static uint64_t Now();
+
+    static const uint32_t MAX_EVENTS_PER_THREAD = 65536; // must be a power of two
+};
+
+// Internal use. Records a zone spanning its own lifetime
+struct diamond_profile_zone
+{
+    diamond_profile_zone(const char* zoneName)
+        : name(zoneName), start(diamond_profiler::Now())
+    {}
+
+    ~diamond_profile_zone()
+    {
+        diamond_profiler::RecordEvent(name, start, diamond_profiler::Now());
+    }
+
+    const char* name;
+    uint64_t start;
+};
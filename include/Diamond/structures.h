@@ -11,6 +11,13 @@
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
 #include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <set>
 
 // See diamond_graphics_pipeline_create_info for info about the usage of these macros
 
@@ -97,16 +104,71 @@ struct diamond_transform
     }
 };
 
+// Image to be packed into a texture atlas
+struct diamond_atlas_image
+{
+    void* data = nullptr; // Raw rgba pixel data. Data will not be freed automatically
+    int width = 0;
+    int height = 0;
+};
+
+// Location of a packed image within a texture atlas
+struct diamond_atlas_entry
+{
+    uint32_t textureId = 0; // Id of the atlas page the image was packed into
+    glm::vec4 texCoords = { 0.f, 0.f, 1.f, 1.f }; // { TL.u, TL.v, BR.u, BR.v } of the image, which can be passed directly as the texCoords of DrawQuad() and friends
+};
+
+// Internal use. Region of device memory handed out by the engine's allocator
+struct diamond_allocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr; // points at offset when the memory is host visible
+    int poolIndex = -1;
+    int blockIndex = -1; // -1 when the allocation owns its memory
+    uint32_t order = 0; // buddy order of allocations from long lived pools
+};
+
 // Internal use
 struct diamond_texture
 {
     VkImage image;
-    VkDeviceMemory memory;
+    diamond_allocation memory;
     VkImageView imageView;
     VkImageLayout imageLayout;
     int width;
     int height;
     uint32_t id;
+    uint64_t uploadHandle; // completes once the pixel data has been copied to the image
+    bool loading = false; // registered asynchronously and not resident yet, so the default texture is bound in its place
+    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+    uint32_t mipLevels = 1;
+    VkImageView storageView = VK_NULL_HANDLE; // single level view which compute shaders write through when the image has mips
+    bool mipsDirty = false; // written by a compute pipeline since its mips were last generated
+    std::string filePath; // source the texture is streamed back in from, empty if it can't be evicted
+    bool compressed = false; // filePath is a KTX2 or DDS file
+    bool evicted = false; // released to stay under the texture memory budget, so the default texture is bound in its place
+    bool failed = false; // the asynchronous load couldn't read the file, so the default texture stays bound
+    uint32_t generation = 0; // bumped whenever the slot is freed, so handles to the previous texture can be told apart
+};
+
+// Internal use
+struct diamond_texture_load
+{
+    uint32_t textureId = 0;
+    uint32_t generation = 0; // the load is dropped if the texture was unregistered in the meantime
+    std::string filePath;
+    unsigned char* pixels = nullptr; // filled in by the worker thread which decoded the image
+    std::vector<uint8_t> mipChain; // every level after the first, generated by the worker as well
+    int width = 0;
+    int height = 0;
+    bool compressed = false; // read as a KTX2 or DDS file instead of being decoded
+    bool failed = false; // the file is missing or couldn't be decoded
+    std::vector<uint8_t> contents; // whole file of a compressed texture
+    std::vector<uint64_t> levelOffsets; // of each compressed level within contents
+    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
 };
 
 // Data provided to the shader via push constants when useCustomPushConstants is false
@@ -122,7 +184,7 @@ struct diamond_vertex
     glm::vec3 pos; // Object space position of the vertex
     glm::vec4 color; // Color to be either rendered by itself or applied as a hue to the texture of the vertex
     glm::vec2 texCoord; // Texture coordinates [0-1]
-    int textureIndex; // Texture to be applied to this specific vertex. Useful when drawing sets of quads in one BindVertices() call. Set to -1 to only render vertex color
+    int textureIndex; // Texture slot to be applied to this specific vertex, see GetTextureSlot(). Useful when drawing sets of quads in one BindVertices() call. Set to -1 to only render vertex color
 
     static VkVertexInputBindingDescription GetBindingDescription()
     {
@@ -225,6 +287,7 @@ struct diamond_compute_image_info
     int width = 0; // width of the image
     int height = 0; // height of the image
     int precision = 8; // 8 16 32 64 precision of each color value
+    bool generateMips = false; // give the image a full mip chain which is regenerated on the graphics queue every frame the image is written, so that drawing it scaled down stays cheap (not supported with 64 bit precision on most devices)
 };
 
 // Information structure for creating a compute pipeline
@@ -257,17 +320,63 @@ struct diamond_graphics_pipeline_create_info
     std::vector<VkVertexInputAttributeDescription> (*getVertexAttributeDescriptions)() = diamond_vertex::GetAttributeDescriptions;
     VkVertexInputBindingDescription (*getVertexBindingDescription)() = diamond_vertex::GetBindingDescription;
     VkPrimitiveTopology vertexTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; // see https://www.khronos.org/registry/vulkan/specs/1.2-extensions/man/html/VkPrimitiveTopology.html
+    VkIndexType indexType = VK_INDEX_TYPE_UINT16; // VK_INDEX_TYPE_UINT32 allows a single draw to index more than 65536 vertices
 
     bool useCustomPushConstants = false; // override the default diamond push constants (diamond_object_data) (see https://vkguide.dev/docs/chapter-3/push_constants/)
     int pushConstantsDataSize = 0; // size of the push constant data struct if useCustomPushConstants is set to true
 
     bool enableDepthTesting = true; // when enabled, the z position of objects will affect the order they show up on the screen
 
-    // max amounts that can be bound to each pipeline
+    // amounts that can initially be bound to each pipeline per frame. The buffers grow whenever a frame binds more
     uint32_t maxVertexCount = 1000;
     uint32_t maxIndexCount = 2000;
 };
 
+// Geometry bound to a graphics pipeline through BindVertices() and BindIndices(), in elements
+// @see GetGeometryUsage()
+struct diamond_geometry_usage
+{
+    uint32_t vertexCount = 0; // claimed during the previous frame, which includes the spare room of recording context chunks
+    uint32_t indexCount = 0;
+    uint32_t peakVertexCount = 0; // highest amount claimed by a single frame since the pipeline was created
+    uint32_t peakIndexCount = 0;
+    uint32_t vertexCapacity = 0; // size of the buffers shared by all frames in flight
+    uint32_t indexCapacity = 0;
+};
+
+// GPU time spent inside one profiled scope of a frame
+// @see GetGpuTimings()
+struct diamond_gpu_timing
+{
+    std::string name;
+    int depth = 0; // how many scopes this one is nested inside of
+    bool compute = false; // executed on the compute queue
+    double time = 0.0; // milliseconds
+};
+
+// Distribution of one frame timing over the frame statistics window
+// @see GetFrameStats()
+struct diamond_frame_timing_stats
+{
+    int sampleCount = 0;
+    double average = 0.0; // milliseconds
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+    int hitchCount = 0; // samples above the hitch budget
+};
+
+// Frame timings tracked over the frame statistics window
+// @see GetFrameStats()
+struct diamond_frame_stats
+{
+    diamond_frame_timing_stats cpu; // BeginFrame() to EndFrame()
+    diamond_frame_timing_stats presentInterval; // between consecutive presents (or submissions when headless)
+    diamond_frame_timing_stats gpu; // main render pass, see GpuFrameDelta()
+    double hitchBudget = 0.0; // milliseconds
+};
+
 // Data always passed to the vertex shader
 // TODO: Custom frame buffers for each graphics pipeline. For now, use push constants for all custom data
 struct diamond_frame_buffer_object
@@ -325,6 +434,7 @@ struct diamond_queue_family_indices
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
     std::optional<uint32_t> computeFamily;
+    std::optional<uint32_t> transferFamily; // same as the graphics family when the device has no dedicated transfer family
     
     bool IsComplete()
     {
@@ -349,10 +459,12 @@ struct diamond_compute_pipeline
 {
     bool enabled = true;
     std::vector<VkBuffer> buffers;
-    std::vector<VkDeviceMemory> buffersMemory;
+    std::vector<diamond_allocation> buffersMemory;
     std::vector<VkBuffer> deviceBuffers;
-    std::vector<VkDeviceMemory> deviceBuffersMemory;
-    std::vector<VkDescriptorSet> descriptorSets;
+    std::vector<diamond_allocation> deviceBuffersMemory;
+    std::vector<VkBuffer> frameDeviceBuffers; // async compute copies of the device buffers for the frames in flight after the first, indexed by buffer * (MAX_FRAMES_IN_FLIGHT - 1) + frame - 1
+    std::vector<diamond_allocation> frameDeviceBuffersMemory;
+    std::vector<VkDescriptorSet> descriptorSets; // one per frame in flight
     std::vector<int> textureIndexes;
     VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
     VkPipeline pipeline = VK_NULL_HANDLE;
@@ -361,16 +473,158 @@ struct diamond_compute_pipeline
     diamond_compute_pipeline_create_info pipelineInfo = {};
 };
 
+// Internal use. Ring buffer used to stream dynamic per frame data to the GPU. Every frame in flight claims the region it writes
+// to, which is only handed out again once that frame's inFlightFence has been waited on
+struct diamond_stream_buffer
+{
+    VkBuffer buffer = VK_NULL_HANDLE;
+    diamond_allocation memory;
+    void* mapped = nullptr; // persistently mapped for the whole lifetime of the buffer
+    VkDeviceSize size = 0;
+    VkDeviceSize head = 0; // next byte to be written
+    VkDeviceSize tail = 0; // first byte which may still be read by a frame in flight
+    std::vector<VkDeviceSize> frameStarts; // head at the start of each frame in flight
+    VkBufferUsageFlags usage = 0;
+    std::vector<VkBuffer> retiredBuffers; // replaced by a larger buffer, but possibly still read by frames in flight
+    std::vector<diamond_allocation> retiredMemory;
+    VkDeviceSize frameUsed = 0; // claimed since the current frame began
+    VkDeviceSize lastFrameUsed = 0;
+    VkDeviceSize peakFrameUsed = 0;
+};
+
+// Internal use. Single vkAllocateMemory which allocations are carved out of
+struct diamond_memory_block
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE; // VK_NULL_HANDLE once released, so that the slot can be reused
+    VkDeviceSize size = 0;
+    void* mapped = nullptr; // host visible blocks stay mapped for their whole lifetime
+    std::vector<std::set<VkDeviceSize>> freeOffsets; // free buddies of every order, only used by long lived pools
+    VkDeviceSize linearOffset = 0; // bump pointer of transient pools, rewound once every allocation has been freed
+    int liveAllocations = 0;
+};
+
+// Internal use. Blocks of one memory type which hold one kind of resource
+struct diamond_memory_pool
+{
+    uint32_t memoryType = 0;
+    bool optimalImages = false; // optimal tiling images never share a block with buffers, so bufferImageGranularity never applies
+    bool transient = false; // linearly allocated, for short lived staging resources
+    VkDeviceSize blockSize = 0;
+    std::vector<diamond_memory_block> blocks;
+};
+
+// Internal use. Uploads recorded into one command buffer and submitted together
+struct diamond_upload_batch
+{
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    uint64_t timelineValue = 0; // value the upload timeline reaches once the batch completes, which doubles as the upload handle
+    bool recording = false;
+    bool submitted = false; // the timeline still has to be waited on before the batch can be reused
+    VkDeviceSize stagingEnd = 0; // staging ring head when the batch was submitted, which becomes the tail once it completes
+    std::vector<VkBuffer> oversizedBuffers; // staging for uploads which are larger than the whole ring, destroyed with the batch
+    std::vector<diamond_allocation> oversizedBuffersMemory;
+};
+
+// Internal use. Geometry uploaded once to device local memory
+struct diamond_static_mesh
+{
+    VkBuffer buffer = VK_NULL_HANDLE; // vertices followed by the indices
+    diamond_allocation memory;
+    VkDeviceSize indexOffset = 0;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    bool enabled = false;
+};
+
+// Internal use. Objects which are destroyed once the graphics timeline shows that no frame can still be using them
+struct diamond_deferred_deletion
+{
+    uint64_t graphicsValue = 0; // the last graphics submission which may reference the objects
+    uint64_t uploadValue = 0; // the last upload batch which may still be copying into the objects
+    std::vector<VkPipeline> pipelines;
+    std::vector<VkPipelineLayout> pipelineLayouts;
+    std::vector<VkCommandPool> commandPools;
+    std::vector<VkDescriptorPool> descriptorPools;
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
+    std::vector<VkImageView> imageViews;
+    std::vector<VkImage> images;
+    std::vector<VkBuffer> buffers;
+    std::vector<diamond_allocation> allocations;
+};
+
+// Internal use. Resource released by the transfer queue family which the graphics family still has to acquire before first use
+struct diamond_upload_acquire
+{
+    VkImage image = VK_NULL_HANDLE; // either an image or a buffer range
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint64_t uploadHandle = 0;
+};
+
+// Internal use. Region of a stream buffer claimed by a recording context, which it sub allocates from without locking
+struct diamond_stream_chunk
+{
+    VkBuffer buffer = VK_NULL_HANDLE; // the stream may have grown into a new buffer since the chunk was claimed
+    uint8_t* mapped = nullptr;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    VkDeviceSize used = 0;
+};
+
+// Internal use. Geometry a recording context has bound to one graphics pipeline during the current frame
+struct diamond_recording_geometry
+{
+    diamond_stream_chunk vertexChunk;
+    diamond_stream_chunk indexChunk;
+    uint32_t boundIndexCount = 0; // index into the stream buffer right after the last bound element
+    uint32_t boundVertexCount = 0;
+    VkBuffer vertexBuffer = VK_NULL_HANDLE; // buffers currently bound to the context's command buffer for this pipeline
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+};
+
+// Internal use. Everything draw calls record into, so that multiple threads can record at once without sharing state
+struct diamond_recording_context
+{
+    bool enabled = true;
+    bool recording = false;
+    bool recorded = false; // recorded during the current frame and should be executed
+    int order = 0;
+    std::vector<VkCommandPool> commandPools; // one per frame in flight; the main context uses the engine's frame pools instead
+    std::vector<VkCommandBuffer> commandBuffers; // secondary render pass buffer for each frame in flight
+    int boundGraphicsPipelineIndex = -1;
+    std::vector<diamond_recording_geometry> geometry; // indexed by graphics pipeline
+    std::vector<int> openGpuScopes; // gpu profiler scopes begun but not yet ended, -1 for scopes which were dropped
+};
+
+// Internal use. Streaming histogram of the most recent samples of a frame timing. Memory is only allocated when the window is configured
+struct diamond_frame_histogram
+{
+    std::vector<uint32_t> buckets; // sample counts per FRAME_HISTOGRAM_BUCKET_WIDTH, the last bucket also counts everything above
+    std::vector<float> samples; // ring of the samples inside the window, needed to remove them again once they fall out of it
+    int nextSample = 0;
+    int sampleCount = 0;
+    int hitchCount = 0;
+};
+
+// Internal use. Pair of timestamp queries recorded during a frame, resolved once the frame's work has completed
+struct diamond_gpu_scope
+{
+    std::string name;
+    int computePipelineIndex = -1; // names dispatches when resolved instead of name
+    int depth = 0;
+    bool compute = false; // queries live in the compute query pool
+    uint32_t beginQuery = 0;
+    uint32_t endQuery = 0;
+};
+
 // Internal use
 struct diamond_graphics_pipeline
 {
     bool enabled = true;
-    VkBuffer vertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
-    VkBuffer indexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
-    uint32_t boundIndexCount = 0;
-    uint32_t boundVertexCount = 0;
+    diamond_stream_buffer vertexStream;
+    diamond_stream_buffer indexStream;
     VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
     VkPipeline pipeline = VK_NULL_HANDLE;
     diamond_graphics_pipeline_create_info pipelineInfo = {};
@@ -8,8 +8,12 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
+#define STBRP_STATIC // imgui compiles its own copy
+#define STB_RECT_PACK_IMPLEMENTATION
+#include <imgui/imstb_rectpack.h>
 
 bool framebufferResized = false;
+thread_local int diamond::threadContextIndex = -1;
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -27,8 +31,10 @@ static void framebufferResizeCallback(GLFWwindow* window, int width, int height)
     framebufferResized = true;
 }
 
-void diamond::Initialize(int width, int height, const char* windowName, const char* defaultTexturePath)
+void diamond::Initialize(int width, int height, const char* windowName, const char* defaultTexturePath, bool enableAsyncCompute)
 {
+    asyncCompute = enableAsyncCompute;
+
     #if DIAMOND_DEBUG
         std::cerr << "Initializing diamond in debug mode" << std::endl;
     #else
@@ -36,6 +42,7 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
     #endif
 
     // init glfw & create window
+    if (!headless)
     {
         glfwInit();
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -53,7 +60,7 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName = "Diamond";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_1;
+        appInfo.apiVersion = VK_API_VERSION_1_2;
 
         // get api extension support
         u32 supportedExtensionCount = 0;
@@ -61,10 +68,11 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
         std::vector<VkExtensionProperties> supportedExtensions(supportedExtensionCount);
         vkEnumerateInstanceExtensionProperties(nullptr, &supportedExtensionCount, supportedExtensions.data());
 
-        // get required extensions
+        // get required extensions (none without a window to present to)
         u32 glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        const char** glfwExtensions = nullptr;
+        if (!headless)
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
         // check for compatability
         for (u32 i = 0; i < glfwExtensionCount; i++)
@@ -115,6 +123,7 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
 #endif
 
     // create window surface
+    if (!headless)
     {
         VkResult result = glfwCreateWindowSurface(instance, window, nullptr, &surface);
         Assert(result == VK_SUCCESS);
@@ -124,7 +133,8 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
     // setup physical device
     {
         // add required device extensions
-        deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        if (!headless)
+            deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
         deviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
 
         // get devices
@@ -141,7 +151,22 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
             {
                 physicalDevice = device;
                 vkGetPhysicalDeviceProperties(device, &physicalDeviceProperties);
+                vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
                 msaaSamples = GetMaxSampleCount();
+
+                VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+                indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+                VkPhysicalDeviceProperties2 properties2{};
+                properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+                properties2.pNext = &indexingProperties;
+                vkGetPhysicalDeviceProperties2(device, &properties2);
+                textureCapacity = std::min({
+                    MAX_TEXTURES,
+                    indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+                    indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                    indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages
+                });
+                textureLastUsed = std::vector<std::atomic<uint64_t>>(textureCapacity);
                 break;
             }
         }
@@ -155,7 +180,7 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
         float queuePriority = 1.0f;
 
         // info for creating queues
-        std::set<u32> uniqueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value(), indices.computeFamily.value() };
+        std::set<u32> uniqueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value(), indices.computeFamily.value(), indices.transferFamily.value() };
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         for (u32 family : uniqueFamilies)
         {
@@ -171,6 +196,13 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
         VkPhysicalDeviceFeatures deviceFeatures{};
         deviceFeatures.samplerAnisotropy = VK_TRUE;
         deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+
+        // compressed formats are optional, IsTextureFormatSupported reports which ones ended up usable
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+        deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+        deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
         
         VkPhysicalDeviceRobustness2FeaturesEXT robustnessFeatures{};
         robustnessFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ROBUSTNESS_2_FEATURES_EXT;
@@ -181,6 +213,14 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
         indexingFeatures.pNext = nullptr;
         indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
         indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        indexingFeatures.descriptorBindingVariableDescriptorCount = VK_TRUE;
+
+        VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        timelineFeatures.pNext = nullptr;
+        timelineFeatures.timelineSemaphore = VK_TRUE;
+        indexingFeatures.pNext = &timelineFeatures;
 
         // finally create device
         VkDeviceCreateInfo createInfo{};
@@ -204,6 +244,8 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
         vkGetDeviceQueue(logicalDevice, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(logicalDevice, indices.presentFamily.value(), 0, &presentQueue);
         vkGetDeviceQueue(logicalDevice, indices.computeFamily.value(), 0, &computeQueue);
+        vkGetDeviceQueue(logicalDevice, indices.transferFamily.value(), 0, &transferQueue);
+        queueFamilies = indices;
     }
     // ------------------------
 
@@ -220,6 +262,7 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
     }
     // ------------------------
 
+    CreateUploadResources();
     RegisterTexture(defaultTexturePath);
 
     CreateSwapChain();
@@ -244,33 +287,14 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
     #if DIAMOND_IMGUI
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
-    ImGui_ImplGlfw_InitForVulkan(window, true);
+    if (!headless)
+        ImGui_ImplGlfw_InitForVulkan(window, true);
     CreateImGui();
     #endif
     // compute pipeline (disabled be default)
     //RecreateCompute(computePipelineInfo);
 
-    // fence
-    VkFenceCreateInfo computeFenceInfo = {};
-    computeFenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    vkCreateFence(logicalDevice, &computeFenceInfo, nullptr, &computeFence);
-    // ------------------------
-
-    CreateCommandBuffers();
-
-    // create rendering secondary command buffer
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
-    allocInfo.commandBufferCount = 1;
-    VkResult result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &renderPassBuffer);
-    Assert(result == VK_SUCCESS);
-
-    // create a primary compute shader buffer
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &computeBuffer);
-    Assert(result == VK_SUCCESS);
+    CreateFrameCommandBuffers();
 
     // create presenting semaphores & fences
     {
@@ -284,6 +308,7 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
         imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
         renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
         inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+        computeFrameValues.resize(MAX_FRAMES_IN_FLIGHT, 0);
         imagesInFlight.resize(swapChain.swapChainImages.size(), VK_NULL_HANDLE);
         for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
         {
@@ -294,12 +319,33 @@ void diamond::Initialize(int width, int height, const char* windowName, const ch
             result = vkCreateFence(logicalDevice, &fenceInfo, nullptr, &inFlightFences[i]);
             Assert(result == VK_SUCCESS);
         }
+
+        // timelines which order the compute and graphics submissions against each other
+        VkSemaphoreTypeCreateInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        timelineInfo.initialValue = 0;
+        semaphoreInfo.pNext = &timelineInfo;
+
+        VkResult result = vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &computeTimeline);
+        Assert(result == VK_SUCCESS);
+        result = vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &graphicsTimeline);
+        Assert(result == VK_SUCCESS);
     }
     // ------------------------
+
+    CreateQueryPools();
+    ConfigureFrameStats(600, 1000.0 / 60.0);
 }
 
 void diamond::CreateSwapChain()
 {
+    if (headless)
+    {
+        CreateOffscreenTargets();
+        return;
+    }
+
     diamond_swap_chain_support_details swapChainSupport = GetSwapChainSupport(physicalDevice);
     VkSurfaceFormatKHR surfaceFormat = ChooseSwapSurfaceFormat(swapChainSupport.formats);
     VkPresentModeKHR presentMode = ChooseSwapPresentMode(swapChainSupport.presentModes);
@@ -357,56 +403,568 @@ void diamond::CreateSwapChain()
     }
 }
 
+void diamond::CreateOffscreenTargets()
+{
+    // stand in for the swap chain images when there is nothing to present to. The render pass leaves them ready to be copied from
+    swapChain.swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+    swapChain.swapChainExtent = headlessExtent;
+    swapChain.swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+    swapChain.swapChainImageViews.resize(MAX_FRAMES_IN_FLIGHT);
+    offscreenImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        CreateImage(headlessExtent.width, headlessExtent.height, swapChain.swapChainImageFormat, 1, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChain.swapChainImages[i], offscreenImagesMemory[i]);
+        swapChain.swapChainImageViews[i] = CreateImageView(swapChain.swapChainImages[i], swapChain.swapChainImageFormat, 1);
+    }
+}
+
+void diamond::ReadbackFrame(void* destination)
+{
+    Assert(headless && lastRenderedImageIndex != -1);
+
+    // wait until the frame which rendered to the image is done
+    vkWaitForFences(logicalDevice, 1, &imagesInFlight[lastRenderedImageIndex], VK_TRUE, UINT64_MAX);
+
+    VkDeviceSize size = static_cast<VkDeviceSize>(swapChain.swapChainExtent.width) * swapChain.swapChainExtent.height * 4;
+    VkBuffer readbackBuffer;
+    diamond_allocation readbackBufferMemory;
+    CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, readbackBufferMemory, false, true);
+
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+    // the render pass writes were submitted earlier to the same queue
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = swapChain.swapChainImages[lastRenderedImageIndex];
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = { swapChain.swapChainExtent.width, swapChain.swapChainExtent.height, 1 };
+    vkCmdCopyImageToBuffer(commandBuffer, swapChain.swapChainImages[lastRenderedImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+    EndSingleTimeCommands(commandBuffer);
+
+    memcpy(destination, readbackBufferMemory.mapped, static_cast<size_t>(size));
+
+    vkDestroyBuffer(logicalDevice, readbackBuffer, nullptr);
+    FreeMemory(readbackBufferMemory);
+}
+
 u32 diamond::RegisterTexture(const char* filePath)
 {
     diamond_texture newTex{};
     newTex.imageView = CreateTextureImage(filePath, newTex.image, newTex.memory, newTex.width, newTex.height);
-    newTex.id = static_cast<u32>(textureArray.size());
+    newTex.uploadHandle = uploadBatches[currentUploadBatch].timelineValue;
+    newTex.mipLevels = GetMipLevelCount(newTex.width, newTex.height);
     newTex.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    textureArray.push_back(newTex);
-    return newTex.id;
+    newTex.filePath = filePath;
+    return AddTexture(newTex);
 }
 
 u32 diamond::RegisterTexture(void* data, int width, int height)
 {
+    return RegisterTexture(data, width, height, VK_FORMAT_R8G8B8A8_SRGB);
+}
+
+u32 diamond::RegisterTexture(void* data, int width, int height, VkFormat format)
+{
+    Assert(IsTextureFormatSupported(format));
+
     diamond_texture newTex{};
-    newTex.imageView = CreateTextureImage(data, newTex.image, newTex.memory, width, height);
-    newTex.id = static_cast<u32>(textureArray.size());
+    newTex.imageView = CreateTextureImage(data, newTex.image, newTex.memory, width, height, nullptr, format);
+    newTex.uploadHandle = uploadBatches[currentUploadBatch].timelineValue;
+    newTex.format = format;
+    newTex.mipLevels = GetMipLevelCount(width, height);
     newTex.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     newTex.width = width;
     newTex.height = height;
-    textureArray.push_back(newTex);
-    return newTex.id;
+    return AddTexture(newTex);
 }
 
-void diamond::SyncTextureUpdates()
+u32 diamond::RegisterCompressedTexture(const char* filePath)
 {
-    // cleanup old resources
-    vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
-    vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+    diamond_texture_load load;
+    load.filePath = filePath;
+    bool loaded = ReadCompressedTexture(load);
+    Assert(loaded && IsTextureFormatSupported(load.format));
 
-    #if DIAMOND_IMGUI
-    CleanupImGui();
-    #endif
+    std::vector<const void*> levels(load.levelOffsets.size());
+    for (int i = 0; i < levels.size(); i++)
+        levels[i] = load.contents.data() + load.levelOffsets[i];
 
-    // recreate bindings
-    CreateDescriptorSetLayout();
-    CreateDescriptorPool();
-    CreateDescriptorSets();
+    diamond_texture newTex{};
+    newTex.imageView = CreateTextureImage(levels.data(), static_cast<u32>(levels.size()), load.format, load.width, load.height, newTex.image, newTex.memory);
+    newTex.uploadHandle = uploadBatches[currentUploadBatch].timelineValue;
+    newTex.format = load.format;
+    newTex.mipLevels = static_cast<u32>(levels.size());
+    newTex.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    newTex.width = load.width;
+    newTex.height = load.height;
+    newTex.filePath = filePath;
+    newTex.compressed = true;
+    return AddTexture(newTex);
+}
 
-    for (int i = 0; i < graphicsPipelines.size(); i++)
+bool diamond::ReadCompressedTexture(diamond_texture_load& load)
+{
+    DIAMOND_PROFILE_FUNCTION();
+
+    // only reads the file, so the texture loading workers can call this as well. Malformed files fail instead of asserting
+    std::ifstream file(load.filePath, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    u64 fileSize = file.tellg();
+    std::vector<u8>& contents = load.contents;
+    contents.resize(fileSize);
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(contents.data()), fileSize);
+    file.close();
+
+    // reads past the end of the file return 0 and fail the load once the header is parsed
+    bool valid = true;
+    auto read32 = [&contents, &valid](u64 offset)
     {
-        if (graphicsPipelines[i].enabled)
+        u32 value = 0;
+        if (offset + sizeof(u32) <= contents.size())
+            memcpy(&value, contents.data() + offset, sizeof(value));
+        else
+            valid = false;
+        return value;
+    };
+    auto read64 = [&contents, &valid](u64 offset)
+    {
+        u64 value = 0;
+        if (offset + sizeof(u64) <= contents.size())
+            memcpy(&value, contents.data() + offset, sizeof(value));
+        else
+            valid = false;
+        return value;
+    };
+    auto fourCC = [](const char* code)
+    {
+        return static_cast<u32>(code[0]) | (static_cast<u32>(code[1]) << 8) | (static_cast<u32>(code[2]) << 16) | (static_cast<u32>(code[3]) << 24);
+    };
+
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    int width = 0;
+    int height = 0;
+    u32 mipLevels = 1;
+
+    const u8 ktx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    if (fileSize >= 80 && memcmp(contents.data(), ktx2Identifier, sizeof(ktx2Identifier)) == 0)
+    {
+        format = static_cast<VkFormat>(read32(12));
+        width = static_cast<int>(read32(20));
+        height = static_cast<int>(read32(24));
+        mipLevels = std::max(read32(40), 1u);
+
+        // only plain 2d textures without supercompression, whose data can be copied as is
+        u32 blockExtent, blockSize;
+        if (read32(28) > 1 || read32(32) > 1 || read32(36) != 1 || read32(44) != 0 || !GetTextureFormatInfo(format, blockExtent, blockSize))
+            return false;
+        if (width <= 0 || height <= 0 || mipLevels > GetMipLevelCount(width, height) || fileSize < 80 + static_cast<u64>(mipLevels) * 24)
+            return false;
+
+        // the level index follows the header and starts with the largest level
+        for (u32 i = 0; i < mipLevels; i++)
         {
-            vkDestroyPipeline(logicalDevice, graphicsPipelines[i].pipeline, nullptr);
-            vkDestroyPipelineLayout(logicalDevice, graphicsPipelines[i].pipelineLayout, nullptr);
-            CreateGraphicsPipeline(graphicsPipelines[i]);
+            u64 levelOffset = read64(80 + i * 24);
+            u64 levelSize = read64(80 + i * 24 + 8);
+            if (levelOffset > fileSize || levelSize > fileSize - levelOffset)
+                return false;
+            if (levelSize != GetTextureLevelSize(format, std::max(width >> i, 1), std::max(height >> i, 1)))
+                return false;
+            load.levelOffsets.push_back(levelOffset);
         }
     }
+    else if (fileSize >= 128 && read32(0) == fourCC("DDS "))
+    {
+        height = static_cast<int>(read32(12));
+        width = static_cast<int>(read32(16));
+        if (read32(8) & 0x20000) // DDSD_MIPMAPCOUNT, the count is left uninitialized otherwise
+            mipLevels = std::max(read32(28), 1u);
+
+        u64 dataOffset = 128;
+        u32 pixelFormat = read32(84);
+        if (pixelFormat == fourCC("DX10"))
+        {
+            if (fileSize < 148)
+                return false;
+            switch (read32(128)) // DXGI_FORMAT
+            {
+                case 71: { format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK; } break;
+                case 72: { format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK; } break;
+                case 74: { format = VK_FORMAT_BC2_UNORM_BLOCK; } break;
+                case 75: { format = VK_FORMAT_BC2_SRGB_BLOCK; } break;
+                case 77: { format = VK_FORMAT_BC3_UNORM_BLOCK; } break;
+                case 78: { format = VK_FORMAT_BC3_SRGB_BLOCK; } break;
+                case 80: { format = VK_FORMAT_BC4_UNORM_BLOCK; } break;
+                case 81: { format = VK_FORMAT_BC4_SNORM_BLOCK; } break;
+                case 83: { format = VK_FORMAT_BC5_UNORM_BLOCK; } break;
+                case 84: { format = VK_FORMAT_BC5_SNORM_BLOCK; } break;
+                case 95: { format = VK_FORMAT_BC6H_UFLOAT_BLOCK; } break;
+                case 96: { format = VK_FORMAT_BC6H_SFLOAT_BLOCK; } break;
+                case 98: { format = VK_FORMAT_BC7_UNORM_BLOCK; } break;
+                case 99: { format = VK_FORMAT_BC7_SRGB_BLOCK; } break;
+                default: {} break;
+            }
+            if (read32(140) > 1) // array size
+                return false;
+            dataOffset += 20;
+        }
+        // legacy color formats don't say whether they are srgb, so they are treated like every other color texture
+        else if (pixelFormat == fourCC("DXT1"))
+            format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+        else if (pixelFormat == fourCC("DXT3"))
+            format = VK_FORMAT_BC2_SRGB_BLOCK;
+        else if (pixelFormat == fourCC("DXT5"))
+            format = VK_FORMAT_BC3_SRGB_BLOCK;
+        else if (pixelFormat == fourCC("ATI1") || pixelFormat == fourCC("BC4U"))
+            format = VK_FORMAT_BC4_UNORM_BLOCK;
+        else if (pixelFormat == fourCC("ATI2") || pixelFormat == fourCC("BC5U"))
+            format = VK_FORMAT_BC5_UNORM_BLOCK;
+        if (format == VK_FORMAT_UNDEFINED || width <= 0 || height <= 0 || mipLevels > GetMipLevelCount(width, height))
+            return false;
 
-    #if DIAMOND_IMGUI
-    CreateImGui();
-    #endif
+        // the levels are tightly packed after the headers
+        for (u32 i = 0; i < mipLevels; i++)
+        {
+            load.levelOffsets.push_back(dataOffset);
+            dataOffset += GetTextureLevelSize(format, std::max(width >> i, 1), std::max(height >> i, 1));
+            if (dataOffset > fileSize)
+                return false;
+        }
+    }
+    else
+        return false;
+    if (!valid)
+        return false;
+
+    load.format = format;
+    load.width = width;
+    load.height = height;
+    return true;
+}
+
+bool diamond::IsTextureFormatSupported(VkFormat format)
+{
+    u32 blockExtent, blockSize;
+    if (!GetTextureFormatInfo(format, blockExtent, blockSize))
+        return false;
+
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+    VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+    return (formatProperties.optimalTilingFeatures & requiredFeatures) == requiredFeatures;
+}
+
+u32 diamond::RegisterTextureAsync(const char* filePath)
+{
+    diamond_texture newTex{};
+    newTex.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    newTex.loading = true;
+    newTex.filePath = filePath;
+    u32 textureId = AddTexture(newTex);
+    QueueTextureLoad(newTex.id);
+
+    return textureId;
+}
+
+void diamond::UnregisterTexture(u32 textureId)
+{
+    u32 slot = GetTextureSlot(textureId);
+    diamond_texture& texture = textureArray[slot];
+    Assert(slot != 0); // stands in for every texture which isn't resident
+    Assert(texture.imageLayout != VK_IMAGE_LAYOUT_GENERAL); // compute images belong to their pipeline
+
+    // loads which are already being decoded are dropped by ProcessTextureLoads() instead
+    {
+        std::lock_guard<std::mutex> lock(textureLoadMutex);
+        queuedTextureLoads.erase(std::remove_if(queuedTextureLoads.begin(), queuedTextureLoads.end(), [slot](const diamond_texture_load& load) { return load.textureId == slot; }), queuedTextureLoads.end());
+    }
+    uploadingTextures.erase(std::remove(uploadingTextures.begin(), uploadingTextures.end(), slot), uploadingTextures.end());
+
+    if (texture.image != VK_NULL_HANDLE)
+    {
+        // the copies into the image may still be pending, and frames only wait on them when the image changes queue families
+        diamond_deferred_deletion& deletion = DeferredDeletion();
+        deletion.uploadValue = std::max(deletion.uploadValue, texture.uploadHandle);
+        deletion.imageViews.push_back(texture.imageView);
+        deletion.images.push_back(texture.image);
+        deletion.allocations.push_back(texture.memory);
+    }
+
+    ReleaseTextureSlot(slot);
+}
+
+u32 diamond::GetTextureSlot(u32 textureId)
+{
+    u32 slot = textureId & ((1u << TEXTURE_SLOT_BITS) - 1);
+    Assert(slot < textureArray.size() && textureArray[slot].id != -1);
+    Assert(textureArray[slot].generation == textureId >> TEXTURE_SLOT_BITS); // the texture was unregistered
+    return slot;
+}
+
+bool diamond::IsTextureResident(u32 textureId)
+{
+    const diamond_texture& texture = textureArray[GetTextureSlot(textureId)];
+    return !texture.loading && !texture.evicted && !texture.failed;
+}
+
+bool diamond::HasTextureLoadFailed(u32 textureId)
+{
+    return textureArray[GetTextureSlot(textureId)].failed;
+}
+
+void diamond::SetTextureMemoryBudget(uint64_t budget)
+{
+    textureMemoryBudget = budget;
+}
+
+uint64_t diamond::GetTextureMemoryUsage()
+{
+    uint64_t usage = 0;
+    for (int i = 0; i < textureArray.size(); i++)
+    {
+        if (textureArray[i].id != -1 && textureArray[i].image != VK_NULL_HANDLE)
+            usage += textureArray[i].memory.size;
+    }
+    return usage;
+}
+
+void diamond::MarkTextureUsed(u32 textureId)
+{
+    // the frame being recorded is submitted with the next value
+    textureLastUsed[GetTextureSlot(textureId)].store(graphicsTimelineValue + 1, std::memory_order_relaxed);
+}
+
+u32 diamond::AddTexture(diamond_texture& texture)
+{
+    // reuse the slots of unregistered textures so that the texture table only grows with the number of live textures
+    if (freeTextureSlots.empty())
+    {
+        texture.id = static_cast<u32>(textureArray.size());
+        Assert(texture.id < textureCapacity);
+        textureArray.push_back(texture);
+    }
+    else
+    {
+        texture.id = freeTextureSlots.back();
+        freeTextureSlots.pop_back();
+        texture.generation = textureArray[texture.id].generation;
+        textureArray[texture.id] = texture;
+    }
+
+    textureLastUsed[texture.id].store(0, std::memory_order_relaxed);
+    QueueTextureDescriptorWrite(texture.id);
+    return MakeTextureHandle(texture.id);
+}
+
+void diamond::ReleaseTextureSlot(u32 slot)
+{
+    // the resources have already been handed to the deferred deletion queue
+    u32 generation = (textureArray[slot].generation + 1) & MAX_TEXTURE_GENERATION;
+    textureArray[slot] = diamond_texture{};
+    textureArray[slot].id = -1;
+    textureArray[slot].generation = generation;
+    freeTextureSlots.push_back(slot);
+    QueueTextureDescriptorWrite(slot);
+}
+
+u32 diamond::MakeTextureHandle(u32 slot)
+{
+    return slot | (textureArray[slot].generation << TEXTURE_SLOT_BITS);
+}
+
+int diamond::UseTexture(int textureIndex)
+{
+    // -1 draws with the vertex color only
+    if (textureIndex < 0)
+        return textureIndex;
+    u32 slot = GetTextureSlot(static_cast<u32>(textureIndex));
+    textureLastUsed[slot].store(graphicsTimelineValue + 1, std::memory_order_relaxed);
+    return static_cast<int>(slot);
+}
+
+std::vector<diamond_atlas_entry> diamond::BuildTextureAtlas(const diamond_atlas_image* images, u32 imageCount, u32 pageSize, u32 padding)
+{
+    DIAMOND_PROFILE_FUNCTION();
+
+    pageSize = std::min(pageSize, physicalDeviceProperties.limits.maxImageDimension2D);
+    std::vector<diamond_atlas_entry> entries(imageCount);
+    std::vector<stbrp_rect> remaining(imageCount);
+    for (u32 i = 0; i < imageCount; i++)
+    {
+        remaining[i].id = static_cast<int>(i);
+        remaining[i].w = static_cast<stbrp_coord>(images[i].width + 2 * padding);
+        remaining[i].h = static_cast<stbrp_coord>(images[i].height + 2 * padding);
+        Assert(images[i].width + 2 * padding <= pageSize && images[i].height + 2 * padding <= pageSize);
+    }
+
+    // a texel of mip level n covers 2^n pixels of the page, so only the levels whose texels stay within the padding are kept
+    u32 paddedMipLevels = 1;
+    while ((1u << paddedMipLevels) <= padding)
+        paddedMipLevels++;
+
+    std::vector<stbrp_node> nodes(pageSize);
+    std::vector<u8> pixels;
+    std::vector<u8> mipChain;
+    while (!remaining.empty())
+    {
+        stbrp_context context;
+        stbrp_init_target(&context, static_cast<int>(pageSize), static_cast<int>(pageSize), nodes.data(), static_cast<int>(nodes.size()));
+        stbrp_pack_rects(&context, remaining.data(), static_cast<int>(remaining.size()));
+
+        // the page is cropped to the packed images, which mostly shrinks the last one
+        u32 pageHeight = 0;
+        for (int i = 0; i < remaining.size(); i++)
+        {
+            if (remaining[i].was_packed)
+                pageHeight = std::max(pageHeight, static_cast<u32>(remaining[i].y + remaining[i].h));
+        }
+        Assert(pageHeight > 0);
+
+        pixels.assign(static_cast<size_t>(pageSize) * pageHeight * 4, 0);
+        std::vector<stbrp_rect> unpacked;
+        std::vector<int> packed;
+        for (int i = 0; i < remaining.size(); i++)
+        {
+            if (!remaining[i].was_packed)
+            {
+                unpacked.push_back(remaining[i]);
+                continue;
+            }
+
+            // every pixel of the padded rect takes the closest pixel of the image, which extrudes its edges into the padding
+            const diamond_atlas_image& image = images[remaining[i].id];
+            const u8* source = reinterpret_cast<const u8*>(image.data);
+            for (int y = 0; y < remaining[i].h; y++)
+            {
+                int sourceY = std::clamp(y - static_cast<int>(padding), 0, image.height - 1);
+                for (int x = 0; x < remaining[i].w; x++)
+                {
+                    int sourceX = std::clamp(x - static_cast<int>(padding), 0, image.width - 1);
+                    size_t destinationIndex = (static_cast<size_t>(remaining[i].y + y) * pageSize + remaining[i].x + x) * 4;
+                    memcpy(pixels.data() + destinationIndex, source + (static_cast<size_t>(sourceY) * image.width + sourceX) * 4, 4);
+                }
+            }
+
+            diamond_atlas_entry& entry = entries[remaining[i].id];
+            entry.texCoords = {
+                static_cast<f32>(remaining[i].x + padding) / pageSize,
+                static_cast<f32>(remaining[i].y + padding) / pageHeight,
+                static_cast<f32>(remaining[i].x + padding + image.width) / pageSize,
+                static_cast<f32>(remaining[i].y + padding + image.height) / pageHeight
+            };
+            packed.push_back(remaining[i].id);
+        }
+
+        u32 mipLevels = std::min(paddedMipLevels, GetMipLevelCount(static_cast<int>(pageSize), static_cast<int>(pageHeight)));
+        if (mipLevels > 1)
+            GenerateMipChain(pixels.data(), static_cast<int>(pageSize), static_cast<int>(pageHeight), VK_FORMAT_R8G8B8A8_SRGB, mipChain);
+
+        std::vector<const void*> levels = { pixels.data() };
+        const u8* level = mipChain.data();
+        for (u32 i = 1; i < mipLevels; i++)
+        {
+            levels.push_back(level);
+            level += GetTextureLevelSize(VK_FORMAT_R8G8B8A8_SRGB, std::max(static_cast<int>(pageSize) >> i, 1), std::max(static_cast<int>(pageHeight) >> i, 1));
+        }
+
+        diamond_texture newTex{};
+        newTex.imageView = CreateTextureImage(levels.data(), mipLevels, VK_FORMAT_R8G8B8A8_SRGB, static_cast<int>(pageSize), static_cast<int>(pageHeight), newTex.image, newTex.memory);
+        newTex.uploadHandle = uploadBatches[currentUploadBatch].timelineValue;
+        newTex.format = VK_FORMAT_R8G8B8A8_SRGB;
+        newTex.mipLevels = mipLevels;
+        newTex.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        newTex.width = static_cast<int>(pageSize);
+        newTex.height = static_cast<int>(pageHeight);
+        u32 textureId = AddTexture(newTex);
+        for (int i = 0; i < packed.size(); i++)
+            entries[packed[i]].textureId = textureId;
+
+        remaining = unpacked;
+    }
+
+    return entries;
+}
+
+std::vector<diamond_atlas_entry> diamond::BuildTextureAtlas(const char** filePaths, u32 imageCount, u32 pageSize, u32 padding)
+{
+    std::vector<diamond_atlas_image> images(imageCount);
+    for (u32 i = 0; i < imageCount; i++)
+    {
+        int channels;
+        images[i].data = stbi_load(filePaths[i], &images[i].width, &images[i].height, &channels, STBI_rgb_alpha);
+        Assert(images[i].data != nullptr);
+    }
+
+    std::vector<diamond_atlas_entry> entries = BuildTextureAtlas(images.data(), imageCount, pageSize, padding);
+
+    for (u32 i = 0; i < imageCount; i++)
+        stbi_image_free(images[i].data);
+    return entries;
+}
+
+uint64_t diamond::GetTextureUploadHandle(u32 textureId)
+{
+    return textureArray[GetTextureSlot(textureId)].uploadHandle;
+}
+
+uint64_t diamond::FlushUploads()
+{
+    uint64_t uploadHandle = uploadTimelineValue;
+    SubmitUploads();
+    return uploadHandle;
+}
+
+bool diamond::IsUploadComplete(uint64_t uploadHandle)
+{
+    uint64_t completedValue = 0;
+    VkResult result = vkGetSemaphoreCounterValue(logicalDevice, uploadTimeline, &completedValue);
+    Assert(result == VK_SUCCESS);
+    return completedValue >= uploadHandle;
+}
+
+void diamond::WaitForUpload(uint64_t uploadHandle)
+{
+    // the batch being recorded would otherwise never signal
+    diamond_upload_batch& batch = uploadBatches[currentUploadBatch];
+    if (batch.recording && batch.timelineValue <= uploadHandle)
+        SubmitUploads();
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &uploadTimeline;
+    waitInfo.pValues = &uploadHandle;
+    vkWaitSemaphores(logicalDevice, &waitInfo, UINT64_MAX);
+}
+
+void diamond::SyncTextureUpdates()
+{
+    // descriptors are written as textures get registered, so only the uploads are left to do
+    SubmitUploads();
 }
 
 int diamond::CreateComputePipeline(diamond_compute_pipeline_create_info createInfo)
@@ -451,7 +1009,6 @@ int diamond::CreateComputePipeline(diamond_compute_pipeline_create_info createIn
 
 void diamond::DeleteComputePipeline(int pipelineIndex)
 {
-    vkDeviceWaitIdle(logicalDevice);
     CleanupCompute(computePipelines[pipelineIndex]);
 }
 
@@ -461,8 +1018,11 @@ int diamond::CreateGraphicsPipeline(diamond_graphics_pipeline_create_info create
     pipeline.pipelineInfo = createInfo;
 
     CreateGraphicsPipeline(pipeline);
-    CreateVertexBuffer(createInfo.vertexSize, createInfo.maxVertexCount, pipeline.vertexBuffer, pipeline.vertexBufferMemory);
-    CreateIndexBuffer(createInfo.maxIndexCount, pipeline.indexBuffer, pipeline.indexBufferMemory);
+
+    // geometry is streamed through ring buffers shared by all frames in flight, sized so that every frame can bind the max amounts
+    CreateStreamBuffer(static_cast<VkDeviceSize>(createInfo.vertexSize) * createInfo.maxVertexCount * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, pipeline.vertexStream);
+    Assert(createInfo.indexType == VK_INDEX_TYPE_UINT16 || createInfo.indexType == VK_INDEX_TYPE_UINT32);
+    CreateStreamBuffer(GetIndexSize(createInfo.indexType) * createInfo.maxIndexCount * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, pipeline.indexStream);
 
     for (int i = 0; i < graphicsPipelines.size(); i++)
     {
@@ -479,23 +1039,35 @@ int diamond::CreateGraphicsPipeline(diamond_graphics_pipeline_create_info create
 
 void diamond::DeleteGraphicsPipeline(int pipelineIndex)
 {
-    vkDeviceWaitIdle(logicalDevice);
     CleanupGraphics(graphicsPipelines[pipelineIndex]);
 }
 
+diamond_geometry_usage diamond::GetGeometryUsage(int pipelineIndex)
+{
+    const diamond_graphics_pipeline& pipeline = graphicsPipelines[pipelineIndex];
+    VkDeviceSize vertexSize = pipeline.pipelineInfo.vertexSize;
+    VkDeviceSize indexSize = GetIndexSize(pipeline.pipelineInfo.indexType);
+
+    diamond_geometry_usage usage{};
+    usage.vertexCount = static_cast<u32>(pipeline.vertexStream.lastFrameUsed / vertexSize);
+    usage.indexCount = static_cast<u32>(pipeline.indexStream.lastFrameUsed / indexSize);
+    usage.peakVertexCount = static_cast<u32>(pipeline.vertexStream.peakFrameUsed / vertexSize);
+    usage.peakIndexCount = static_cast<u32>(pipeline.indexStream.peakFrameUsed / indexSize);
+    usage.vertexCapacity = static_cast<u32>(pipeline.vertexStream.size / vertexSize);
+    usage.indexCapacity = static_cast<u32>(pipeline.indexStream.size / indexSize);
+    return usage;
+}
+
 int diamond::GetComputeTextureIndex(int pipelineIndex, int imageIndex)
 {
     if (computePipelines[pipelineIndex].pipelineInfo.imageCount == 0)
         return -1;
-    return computePipelines[pipelineIndex].textureIndexes[imageIndex];
+    return static_cast<int>(MakeTextureHandle(static_cast<u32>(computePipelines[pipelineIndex].textureIndexes[imageIndex])));
 }
 
 void diamond::RetrieveComputeData(int pipelineIndex, int bufferIndex, int dataOffset, int dataSize, void* destination)
 {
-    void *mapped;
-    vkMapMemory(logicalDevice, computePipelines[pipelineIndex].buffersMemory[bufferIndex], dataOffset, dataSize, 0, &mapped);
-    memcpy(destination, mapped, dataSize);
-    vkUnmapMemory(logicalDevice, computePipelines[pipelineIndex].buffersMemory[bufferIndex]);
+    memcpy(destination, static_cast<u8*>(computePipelines[pipelineIndex].buffersMemory[bufferIndex].mapped) + dataOffset, dataSize);
 }
 
 void diamond::MapComputeData(int pipelineIndex, int bufferIndex, int dataOffset, int dataSize, void* source)
@@ -509,19 +1081,23 @@ void diamond::UploadComputeData(int pipelineIndex, int bufferIndex)
     {
         VkBufferCopy copy = {};
         copy.size = computePipelines[pipelineIndex].pipelineInfo.bufferInfoList[bufferIndex].size;
+
+        if (computeDispatched) // don't overwrite data an earlier dispatch is still using
+            MemoryBarrier(computeBuffers[currentFrameIndex], VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
         
-        vkCmdCopyBuffer(computeBuffer, computePipelines[pipelineIndex].buffers[bufferIndex], computePipelines[pipelineIndex].deviceBuffers[bufferIndex], 1, &copy);
+        VkBuffer deviceBuffer = GetComputeDeviceBuffer(computePipelines[pipelineIndex], bufferIndex, currentFrameIndex);
+        vkCmdCopyBuffer(computeBuffers[currentFrameIndex], computePipelines[pipelineIndex].buffers[bufferIndex], deviceBuffer, 1, &copy);
 
         VkBufferMemoryBarrier ub_barrier = {};
         ub_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
         ub_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
         ub_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-        ub_barrier.buffer = computePipelines[pipelineIndex].deviceBuffers[bufferIndex],
+        ub_barrier.buffer = deviceBuffer,
         ub_barrier.offset = 0,
         ub_barrier.size = copy.size,
 
         vkCmdPipelineBarrier (
-            computeBuffer,
+            computeBuffers[currentFrameIndex],
             VK_PIPELINE_STAGE_TRANSFER_BIT,
             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
             0,
@@ -538,8 +1114,11 @@ void diamond::DownloadComputeData(int pipelineIndex, int bufferIndex)
     {
         VkBufferCopy copy = {};
         copy.size = computePipelines[pipelineIndex].pipelineInfo.bufferInfoList[bufferIndex].size;
+
+        if (computeDispatched) // make the results of earlier dispatches visible to the copy
+            MemoryBarrier(computeBuffers[currentFrameIndex], VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
         
-        vkCmdCopyBuffer(computeBuffer, computePipelines[pipelineIndex].deviceBuffers[bufferIndex], computePipelines[pipelineIndex].buffers[bufferIndex], 1, &copy);
+        vkCmdCopyBuffer(computeBuffers[currentFrameIndex], GetComputeDeviceBuffer(computePipelines[pipelineIndex], bufferIndex, currentFrameIndex), computePipelines[pipelineIndex].buffers[bufferIndex], 1, &copy);
     }
 }
 
@@ -549,25 +1128,38 @@ void diamond::RunComputeShader(int pipelineIndex, void* pushConsantsData)
     const diamond_compute_pipeline_create_info& pipelineInfo = pipeline.pipelineInfo;
     if (pipeline.enabled) // run compute pipeline if enabled
     {
-        vkCmdBindPipeline(computeBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
-        vkCmdBindDescriptorSets(computeBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipelineLayout, 0, 1, &pipeline.descriptorSets[0], 0, nullptr);
+        // only dispatches which follow another one in the same frame need to wait on its writes. Consumers on
+        // the graphics queue are synchronized by the timeline semaphore instead
+        if (computeDispatched)
+            MemoryBarrier(computeBuffers[currentFrameIndex], VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        vkCmdBindPipeline(computeBuffers[currentFrameIndex], VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+        vkCmdBindDescriptorSets(computeBuffers[currentFrameIndex], VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipelineLayout, 0, 1, &pipeline.descriptorSets[currentFrameIndex], 0, nullptr);
 
         if (pipelineInfo.usePushConstants)
         {
-            vkCmdPushConstants(computeBuffer, pipeline.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, pipelineInfo.pushConstantsDataSize, pushConsantsData);
+            vkCmdPushConstants(computeBuffers[currentFrameIndex], pipeline.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, pipelineInfo.pushConstantsDataSize, pushConsantsData);
         }
 
         // dispatch compute pipeline
+        int scope = ReserveGpuScope(nullptr, 0, true, pipelineIndex);
+        WriteGpuTimestamp(computeBuffers[currentFrameIndex], scope, false);
         vkCmdDispatch(
-            computeBuffer,
+            computeBuffers[currentFrameIndex],
             std::min(pipelineInfo.groupCountX, physicalDeviceProperties.limits.maxComputeWorkGroupCount[0]),
             std::min(pipelineInfo.groupCountY, physicalDeviceProperties.limits.maxComputeWorkGroupCount[1]),
             std::min(pipelineInfo.groupCountZ, physicalDeviceProperties.limits.maxComputeWorkGroupCount[2])
         );
+        WriteGpuTimestamp(computeBuffers[currentFrameIndex], scope, true);
+
+        for (int i = 0; i < pipeline.textureIndexes.size(); i++)
+        {
+            diamond_texture& texture = textureArray[pipeline.textureIndexes[i]];
+            if (texture.mipLevels > 1)
+                texture.mipsDirty = true;
+        }
 
-        //vkCmdPipelineBarrier(computeBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
-        MemoryBarrier(computeBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT); // post run sync
-        MemoryBarrier(computeBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT); // post run sync
+        computeDispatched = true;
     }
 }
 
@@ -588,11 +1180,9 @@ void diamond::BindVertices(const void* vertices, u32 vertexCount)
 
 void diamond::BindVertices(void* vertices, u32 vertexCount)
 {
-    if (boundGraphicsPipelineIndex != -1)
-    {
-        MapMemory(vertices, graphicsPipelines[boundGraphicsPipelineIndex].pipelineInfo.vertexSize, vertexCount, graphicsPipelines[boundGraphicsPipelineIndex].vertexBufferMemory, graphicsPipelines[boundGraphicsPipelineIndex].boundVertexCount);
-        graphicsPipelines[boundGraphicsPipelineIndex].boundVertexCount += vertexCount;
-    }
+    void* destination = ReserveVertices(vertexCount);
+    if (destination != nullptr)
+        memcpy(destination, vertices, static_cast<size_t>(graphicsPipelines[CurrentContext().boundGraphicsPipelineIndex].pipelineInfo.vertexSize) * vertexCount);
 }
 
 void diamond::BindIndices(const u16* indices, u32 indexCount)
@@ -602,75 +1192,228 @@ void diamond::BindIndices(const u16* indices, u32 indexCount)
 
 void diamond::BindIndices(u16* indices, u32 indexCount)
 {
-    if (boundGraphicsPipelineIndex != -1)
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex == -1)
+        return;
+
+    if (graphicsPipelines[context.boundGraphicsPipelineIndex].pipelineInfo.indexType == VK_INDEX_TYPE_UINT16)
     {
-        MapMemory((u16*)indices, sizeof(u16), indexCount, graphicsPipelines[boundGraphicsPipelineIndex].indexBufferMemory, graphicsPipelines[boundGraphicsPipelineIndex].boundIndexCount);
-        graphicsPipelines[boundGraphicsPipelineIndex].boundIndexCount += indexCount;
+        u16* destination = ReserveIndices(indexCount);
+        memcpy(destination, indices, sizeof(u16) * indexCount);
     }
-}
-
-void diamond::Draw(u32 vertexCount, void* pushConstantsData)
-{
-    if (boundGraphicsPipelineIndex != -1)
+    else
     {
-        if (graphicsPipelines[boundGraphicsPipelineIndex].pipelineInfo.useCustomPushConstants)
-        {
-            vkCmdPushConstants(renderPassBuffer, graphicsPipelines[boundGraphicsPipelineIndex].pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, graphicsPipelines[boundGraphicsPipelineIndex].pipelineInfo.pushConstantsDataSize, pushConstantsData);
-        }
-        vkCmdDraw(renderPassBuffer, vertexCount, 1, graphicsPipelines[boundGraphicsPipelineIndex].boundVertexCount - vertexCount, 0);
+        // widened while writing since the stream memory is write combined
+        u32* destination = ReserveIndices32(indexCount);
+        for (u32 i = 0; i < indexCount; i++)
+            destination[i] = indices[i];
     }
 }
 
-void diamond::Draw(u32 vertexCount, int textureIndex, diamond_transform objectTransform)
+void diamond::BindIndices(const u32* indices, u32 indexCount)
 {
-    if (boundGraphicsPipelineIndex != -1)
-    {
-        diamond_object_data data;
-        data.textureIndex = textureIndex;
-        data.model = GenerateModelMatrix(objectTransform);
-
-        vkCmdPushConstants(renderPassBuffer, graphicsPipelines[boundGraphicsPipelineIndex].pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(diamond_object_data), &data);
-        vkCmdDraw(renderPassBuffer, vertexCount, 1, graphicsPipelines[boundGraphicsPipelineIndex].boundVertexCount - vertexCount, 0);
-    }
+    BindIndices(const_cast<u32*>(indices), indexCount);
+}
+
+void diamond::BindIndices(u32* indices, u32 indexCount)
+{
+    u32* destination = ReserveIndices32(indexCount);
+    if (destination != nullptr)
+        memcpy(destination, indices, sizeof(u32) * indexCount);
+}
+
+void* diamond::ReserveVertices(u32 vertexCount)
+{
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex == -1)
+        return nullptr;
+
+    diamond_graphics_pipeline& pipeline = graphicsPipelines[context.boundGraphicsPipelineIndex];
+    diamond_recording_geometry& geometry = context.geometry[context.boundGraphicsPipelineIndex];
+    VkDeviceSize vertexSize = pipeline.pipelineInfo.vertexSize;
+    VkDeviceSize offset = AllocateContextStreamMemory(context, pipeline.vertexStream, geometry.vertexChunk, vertexSize * vertexCount, vertexSize);
+
+    // first geometry of the frame, or the stream has grown into a new buffer
+    if (geometry.vertexChunk.buffer != geometry.vertexBuffer)
+    {
+        VkDeviceSize offsets[] = { 0 };
+        vkCmdBindVertexBuffers(context.commandBuffers[currentFrameIndex], 0, 1, &geometry.vertexChunk.buffer, offsets);
+        geometry.vertexBuffer = geometry.vertexChunk.buffer;
+    }
+
+    geometry.boundVertexCount = static_cast<u32>(offset / vertexSize) + vertexCount;
+    return geometry.vertexChunk.mapped + offset;
+}
+
+u16* diamond::ReserveIndices(u32 indexCount)
+{
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex == -1)
+        return nullptr;
+
+    Assert(graphicsPipelines[context.boundGraphicsPipelineIndex].pipelineInfo.indexType == VK_INDEX_TYPE_UINT16);
+    return reinterpret_cast<u16*>(ReserveIndexMemory(indexCount));
+}
+
+u32* diamond::ReserveIndices32(u32 indexCount)
+{
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex == -1)
+        return nullptr;
+
+    Assert(graphicsPipelines[context.boundGraphicsPipelineIndex].pipelineInfo.indexType == VK_INDEX_TYPE_UINT32);
+    return reinterpret_cast<u32*>(ReserveIndexMemory(indexCount));
+}
+
+void diamond::Draw(u32 vertexCount, void* pushConstantsData)
+{
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex != -1)
+    {
+        const diamond_graphics_pipeline& pipeline = graphicsPipelines[context.boundGraphicsPipelineIndex];
+        if (pipeline.pipelineInfo.useCustomPushConstants)
+        {
+            vkCmdPushConstants(context.commandBuffers[currentFrameIndex], pipeline.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, pipeline.pipelineInfo.pushConstantsDataSize, pushConstantsData);
+        }
+        vkCmdDraw(context.commandBuffers[currentFrameIndex], vertexCount, 1, context.geometry[context.boundGraphicsPipelineIndex].boundVertexCount - vertexCount, 0);
+    }
+}
+
+void diamond::Draw(u32 vertexCount, int textureIndex, diamond_transform objectTransform)
+{
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex != -1)
+    {
+        diamond_object_data data;
+        data.textureIndex = UseTexture(textureIndex);
+        data.model = GenerateModelMatrix(objectTransform);
+
+        vkCmdPushConstants(context.commandBuffers[currentFrameIndex], graphicsPipelines[context.boundGraphicsPipelineIndex].pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(diamond_object_data), &data);
+        vkCmdDraw(context.commandBuffers[currentFrameIndex], vertexCount, 1, context.geometry[context.boundGraphicsPipelineIndex].boundVertexCount - vertexCount, 0);
+    }
 }
 
 void diamond::DrawIndexed(u32 indexCount, u32 vertexCount, void* pushConstantsData)
 {
-    if (boundGraphicsPipelineIndex != -1)
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex != -1)
     {
-        if (graphicsPipelines[boundGraphicsPipelineIndex].pipelineInfo.useCustomPushConstants)
+        const diamond_graphics_pipeline& pipeline = graphicsPipelines[context.boundGraphicsPipelineIndex];
+        const diamond_recording_geometry& geometry = context.geometry[context.boundGraphicsPipelineIndex];
+        if (pipeline.pipelineInfo.useCustomPushConstants)
         {
-            vkCmdPushConstants(renderPassBuffer, graphicsPipelines[boundGraphicsPipelineIndex].pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, graphicsPipelines[boundGraphicsPipelineIndex].pipelineInfo.pushConstantsDataSize, pushConstantsData);
+            vkCmdPushConstants(context.commandBuffers[currentFrameIndex], pipeline.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, pipeline.pipelineInfo.pushConstantsDataSize, pushConstantsData);
         }
-        vkCmdDrawIndexed(renderPassBuffer, indexCount, 1, graphicsPipelines[boundGraphicsPipelineIndex].boundIndexCount - indexCount, graphicsPipelines[boundGraphicsPipelineIndex].boundVertexCount - vertexCount, 0);
+        vkCmdDrawIndexed(context.commandBuffers[currentFrameIndex], indexCount, 1, geometry.boundIndexCount - indexCount, geometry.boundVertexCount - vertexCount, 0);
     }
 }
 
 void diamond::DrawIndexed(u32 indexCount, u32 vertexCount, int textureIndex, diamond_transform objectTransform)
 {
-    if (boundGraphicsPipelineIndex != -1)
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex != -1)
     {
+        const diamond_recording_geometry& geometry = context.geometry[context.boundGraphicsPipelineIndex];
         diamond_object_data data;
-        data.textureIndex = textureIndex;
+        data.textureIndex = UseTexture(textureIndex);
         data.model = GenerateModelMatrix(objectTransform);
 
-        vkCmdPushConstants(renderPassBuffer, graphicsPipelines[boundGraphicsPipelineIndex].pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(diamond_object_data), &data);
-        vkCmdDrawIndexed(renderPassBuffer, indexCount, 1, graphicsPipelines[boundGraphicsPipelineIndex].boundIndexCount - indexCount, graphicsPipelines[boundGraphicsPipelineIndex].boundVertexCount - vertexCount, 0);
+        vkCmdPushConstants(context.commandBuffers[currentFrameIndex], graphicsPipelines[context.boundGraphicsPipelineIndex].pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(diamond_object_data), &data);
+        vkCmdDrawIndexed(context.commandBuffers[currentFrameIndex], indexCount, 1, geometry.boundIndexCount - indexCount, geometry.boundVertexCount - vertexCount, 0);
     }
 }
 
 void diamond::DrawFromCompute(int pipelineIndex, int bufferIndex, u32 vertexCount)
 {
+    diamond_recording_context& context = CurrentContext();
     VkDeviceSize offsets[] = { 0 };
-    if (computePipelines[pipelineIndex].pipelineInfo.bufferInfoList[bufferIndex].staging)
-        vkCmdBindVertexBuffers(renderPassBuffer, 0, 1, &computePipelines[pipelineIndex].deviceBuffers[bufferIndex], offsets);
-    else
-        vkCmdBindVertexBuffers(renderPassBuffer, 0, 1, &computePipelines[pipelineIndex].buffers[bufferIndex], offsets);
-    vkCmdDraw(renderPassBuffer, vertexCount, 1, 0, 0);
+    VkBuffer vertexBuffer = GetComputeDeviceBuffer(computePipelines[pipelineIndex], bufferIndex, currentFrameIndex);
+    vkCmdBindVertexBuffers(context.commandBuffers[currentFrameIndex], 0, 1, &vertexBuffer, offsets);
+    vkCmdDraw(context.commandBuffers[currentFrameIndex], vertexCount, 1, 0, 0);
+
+    if (context.boundGraphicsPipelineIndex != -1 && context.geometry[context.boundGraphicsPipelineIndex].vertexBuffer != VK_NULL_HANDLE)
+    {
+        vkCmdBindVertexBuffers(context.commandBuffers[currentFrameIndex], 0, 1, &context.geometry[context.boundGraphicsPipelineIndex].vertexBuffer, offsets);
+    }
+}
+
+int diamond::CreateStaticMesh(const void* vertices, u32 vertexCount, u32 vertexSize, const u16* indices, u32 indexCount)
+{
+    return CreateStaticMesh(vertices, vertexCount, vertexSize, static_cast<const void*>(indices), indexCount, VK_INDEX_TYPE_UINT16);
+}
+
+int diamond::CreateStaticMesh(const void* vertices, u32 vertexCount, u32 vertexSize, const u32* indices, u32 indexCount)
+{
+    return CreateStaticMesh(vertices, vertexCount, vertexSize, static_cast<const void*>(indices), indexCount, VK_INDEX_TYPE_UINT32);
+}
+
+int diamond::CreateStaticMesh(const void* vertices, u32 vertexCount, u32 vertexSize, const void* indices, u32 indexCount, VkIndexType indexType)
+{
+    DIAMOND_PROFILE_FUNCTION();
+    Assert(vertices != nullptr && vertexCount > 0);
+
+    diamond_static_mesh mesh{};
+    mesh.vertexCount = vertexCount;
+    mesh.indexCount = indices == nullptr ? 0 : indexCount;
+    mesh.indexType = indexType;
+
+    VkDeviceSize vertexDataSize = static_cast<VkDeviceSize>(vertexSize) * vertexCount;
+    VkDeviceSize indexDataSize = GetIndexSize(indexType) * mesh.indexCount;
+    mesh.indexOffset = ((vertexDataSize + 3) / 4) * 4;
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    if (mesh.indexCount > 0)
+        usage |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    CreateBuffer(mesh.indexOffset + indexDataSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.buffer, mesh.memory);
+
+    UploadBufferData(mesh.buffer, 0, vertices, vertexDataSize);
+    if (mesh.indexCount > 0)
+        UploadBufferData(mesh.buffer, mesh.indexOffset, indices, indexDataSize);
+    mesh.enabled = true;
+
+    for (int i = 0; i < staticMeshes.size(); i++)
+    {
+        if (!staticMeshes[i].enabled)
+        {
+            staticMeshes[i] = mesh;
+            return i;
+        }
+    }
+
+    staticMeshes.push_back(mesh);
+    return static_cast<int>(staticMeshes.size() - 1);
+}
+
+void diamond::DeleteStaticMesh(int meshIndex)
+{
+    CleanupStaticMesh(staticMeshes[meshIndex]);
+}
+
+void diamond::DrawStaticMesh(int meshIndex, void* pushConstantsData)
+{
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex != -1)
+    {
+        const diamond_graphics_pipeline& pipeline = graphicsPipelines[context.boundGraphicsPipelineIndex];
+        if (pipeline.pipelineInfo.useCustomPushConstants)
+        {
+            vkCmdPushConstants(context.commandBuffers[currentFrameIndex], pipeline.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, pipeline.pipelineInfo.pushConstantsDataSize, pushConstantsData);
+        }
+        RecordStaticMeshDraw(context, staticMeshes[meshIndex]);
+    }
+}
 
-    if (boundGraphicsPipelineIndex != -1)
+void diamond::DrawStaticMesh(int meshIndex, int textureIndex, diamond_transform objectTransform)
+{
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex != -1)
     {
-        vkCmdBindVertexBuffers(renderPassBuffer, 0, 1, &graphicsPipelines[boundGraphicsPipelineIndex].vertexBuffer, offsets);
+        diamond_object_data data;
+        data.textureIndex = UseTexture(textureIndex);
+        data.model = GenerateModelMatrix(objectTransform);
+
+        vkCmdPushConstants(context.commandBuffers[currentFrameIndex], graphicsPipelines[context.boundGraphicsPipelineIndex].pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(diamond_object_data), &data);
+        RecordStaticMeshDraw(context, staticMeshes[meshIndex]);
     }
 }
 
@@ -682,130 +1425,169 @@ void diamond::DrawQuad(int textureIndex, diamond_transform quadTransform, glm::v
 
 void diamond::DrawQuad(int textureIndex, glm::vec4 texCoords, diamond_transform quadTransform, glm::vec4 color)
 {
-    const diamond_vertex vertices[] =
-    {
-        {{-0.5f, -0.5f, 0.f}, color, {texCoords.x, texCoords.w}, -1},
-        {{0.5f, -0.5f, 0.f}, color, {texCoords.z, texCoords.w}, -1},
-        {{0.5f, 0.5f, 0.f}, color, {texCoords.z, texCoords.y}, -1},
-        {{-0.5f, 0.5f, 0.f}, color, {texCoords.x, texCoords.y}, -1}
-    };
-    const u16 indices[] =
-    {
-        0, 3, 2, 2, 1, 0
-    };
+    diamond_vertex* vertices = ReserveVertices<diamond_vertex>(4);
+    void* indices = ReserveIndexMemory(6);
+    if (vertices == nullptr)
+        return;
+
+    vertices[0] = {{-0.5f, -0.5f, 0.f}, color, {texCoords.x, texCoords.w}, -1};
+    vertices[1] = {{0.5f, -0.5f, 0.f}, color, {texCoords.z, texCoords.w}, -1};
+    vertices[2] = {{0.5f, 0.5f, 0.f}, color, {texCoords.z, texCoords.y}, -1};
+    vertices[3] = {{-0.5f, 0.5f, 0.f}, color, {texCoords.x, texCoords.y}, -1};
+    WriteQuadIndices(indices, 0, graphicsPipelines[CurrentContext().boundGraphicsPipelineIndex].pipelineInfo.indexType);
 
-    BindVertices(vertices, 4);
-    BindIndices(indices, 6);
     DrawIndexed(6, 4, textureIndex, quadTransform);
 }
 
 void diamond::DrawAnimatedQuad(int textureIndex, int framesPerRow, int totalFrames, int currentFrame, diamond_transform quadTransform, glm::vec4 color)
 {
-    int width = textureArray[textureIndex].width;
-    int height = textureArray[textureIndex].height;
-    glm::vec2 frameSize = { (f32)width / framesPerRow / width, (f32)height / (totalFrames / framesPerRow) / height };
+    // independent of the texture size, which is unknown while it is loading
+    glm::vec2 frameSize = { 1.f / framesPerRow, 1.f / (totalFrames / framesPerRow) };
     currentFrame = currentFrame % totalFrames;
     f32 frameX = static_cast<f32>(currentFrame % framesPerRow);
     f32 frameY = static_cast<f32>(currentFrame / framesPerRow);
 
-    const diamond_vertex vertices[] =
-    {
-        {{-0.5f, -0.5f, 0.f}, color, { frameSize.x * frameX, frameSize.y * (frameY + 1) }, -1},
-        {{0.5f, -0.5f, 0.f}, color, { frameSize.x * (frameX + 1), frameSize.y * (frameY + 1) }, -1},
-        {{0.5f, 0.5f, 0.f}, color, { frameSize.x * (frameX + 1), frameSize.y * frameY }, -1},
-        {{-0.5f, 0.5f, 0.f}, color, { frameSize.x * frameX, frameSize.y * frameY }, -1}
-    };
-    const u16 indices[] =
-    {
-        0, 3, 2, 2, 1, 0
-    };
+    diamond_vertex* vertices = ReserveVertices<diamond_vertex>(4);
+    void* indices = ReserveIndexMemory(6);
+    if (vertices == nullptr)
+        return;
+
+    vertices[0] = {{-0.5f, -0.5f, 0.f}, color, { frameSize.x * frameX, frameSize.y * (frameY + 1) }, -1};
+    vertices[1] = {{0.5f, -0.5f, 0.f}, color, { frameSize.x * (frameX + 1), frameSize.y * (frameY + 1) }, -1};
+    vertices[2] = {{0.5f, 0.5f, 0.f}, color, { frameSize.x * (frameX + 1), frameSize.y * frameY }, -1};
+    vertices[3] = {{-0.5f, 0.5f, 0.f}, color, { frameSize.x * frameX, frameSize.y * frameY }, -1};
+    WriteQuadIndices(indices, 0, graphicsPipelines[CurrentContext().boundGraphicsPipelineIndex].pipelineInfo.indexType);
 
-    BindVertices(vertices, 4);
-    BindIndices(indices, 6);
     DrawIndexed(6, 4, textureIndex, quadTransform);
 }
 
 void diamond::DrawQuadsTransform(int* textureIndexes, diamond_transform* quadTransforms, int quadCount, diamond_transform originTransform, glm::vec4* colors, glm::vec4* texCoords)
 {
-    if (quadVertices.size() < quadCount * 4)
-        quadVertices.resize(quadCount * 4);
-    if (quadIndices.size() < quadCount * 6)
-        quadIndices.resize(quadCount * 6);
+    DIAMOND_PROFILE_FUNCTION();
 
-    const u16 baseIndices[] =
-    {
-        0, 3, 2, 2, 1, 0
-    };
+    int batchSize = GetQuadBatchSize(quadCount);
+    if (batchSize == 0)
+        return;
+    VkIndexType indexType = graphicsPipelines[CurrentContext().boundGraphicsPipelineIndex].pipelineInfo.indexType;
 
-    for (int i = 0; i < quadCount; i++)
+    for (int batchStart = 0; batchStart < quadCount; batchStart += batchSize)
     {
-        int vertexIndex = 4 * i;
-        int indicesIndex = 6 * i;
+        int batchCount = std::min(batchSize, quadCount - batchStart);
+        diamond_vertex* quadVertices = ReserveVertices<diamond_vertex>(static_cast<u32>(batchCount * 4));
+        void* quadIndices = ReserveIndexMemory(static_cast<u32>(batchCount * 6));
 
-        glm::mat4 modelMatrix = GenerateModelMatrix(quadTransforms[i]);
-        glm::vec4 color = { 1.f, 1.f, 1.f, 1.f };
-        glm::vec4 texCoord = { 0.f, 0.f, 1.f, 1.f };
-        if (colors != nullptr)
-            color = colors[i];
-        if (texCoords != nullptr)
-            texCoord = texCoords[i];
+        for (int j = 0; j < batchCount; j++)
+        {
+            int i = batchStart + j;
+            int vertexIndex = 4 * j;
+
+            glm::mat4 modelMatrix = GenerateModelMatrix(quadTransforms[i]);
+            int textureIndex = UseTexture(textureIndexes[i]);
+            glm::vec4 color = { 1.f, 1.f, 1.f, 1.f };
+            glm::vec4 texCoord = { 0.f, 0.f, 1.f, 1.f };
+            if (colors != nullptr)
+                color = colors[i];
+            if (texCoords != nullptr)
+                texCoord = texCoords[i];
+
+            quadVertices[vertexIndex] =     { modelMatrix * glm::vec4(-0.5f, -0.5f, 0.f, 1.f), color, { texCoord.x, texCoord.w }, textureIndex};
+            quadVertices[vertexIndex + 1] = { modelMatrix * glm::vec4(0.5f, -0.5f, 0.f, 1.f), color, { texCoord.z, texCoord.w }, textureIndex};
+            quadVertices[vertexIndex + 2] = { modelMatrix * glm::vec4(0.5f, 0.5f, 0.f, 1.f), color, { texCoord.z, texCoord.y }, textureIndex};
+            quadVertices[vertexIndex + 3] = { modelMatrix * glm::vec4(-0.5f, 0.5f, 0.f, 1.f), color, { texCoord.x, texCoord.y }, textureIndex};
+            WriteQuadIndices(quadIndices, static_cast<u32>(j), indexType);
+        }
 
-        quadVertices[vertexIndex] =     { modelMatrix * glm::vec4(-0.5f, -0.5f, 0.f, 1.f), color, { texCoord.x, texCoord.w }, textureIndexes[i]};
-        quadVertices[vertexIndex + 1] = { modelMatrix * glm::vec4(0.5f, -0.5f, 0.f, 1.f), color, { texCoord.z, texCoord.w }, textureIndexes[i]};
-        quadVertices[vertexIndex + 2] = { modelMatrix * glm::vec4(0.5f, 0.5f, 0.f, 1.f), color, { texCoord.z, texCoord.y }, textureIndexes[i]};
-        quadVertices[vertexIndex + 3] = { modelMatrix * glm::vec4(-0.5f, 0.5f, 0.f, 1.f), color, { texCoord.x, texCoord.y }, textureIndexes[i]};
-        quadIndices[indicesIndex] =     baseIndices[0] + vertexIndex;
-        quadIndices[indicesIndex + 1] = baseIndices[1] + vertexIndex;
-        quadIndices[indicesIndex + 2] = baseIndices[2] + vertexIndex;
-        quadIndices[indicesIndex + 3] = baseIndices[3] + vertexIndex;
-        quadIndices[indicesIndex + 4] = baseIndices[4] + vertexIndex;
-        quadIndices[indicesIndex + 5] = baseIndices[5] + vertexIndex;
+        DrawIndexed(static_cast<u32>(batchCount * 6), static_cast<u32>(batchCount * 4), -1, originTransform);
     }
-
-    BindVertices(quadVertices.data(), static_cast<u32>(quadCount * 4));
-    BindIndices(quadIndices.data(), static_cast<u32>(quadCount * 6));
-    DrawIndexed(static_cast<u32>(quadCount * 6), static_cast<u32>(quadCount * 4), -1, originTransform);
 }
 
 void diamond::DrawQuadsOffsetScale(int* textureIndexes, glm::vec4* offsetScales, int quadCount, diamond_transform originTransform, glm::vec4* colors, glm::vec4* texCoords)
 {
-    if (quadVertices.size() < quadCount * 4)
-        quadVertices.resize(quadCount * 4);
-    if (quadIndices.size() < quadCount * 6)
-        quadIndices.resize(quadCount * 6);
+    int batchSize = GetQuadBatchSize(quadCount);
+    if (batchSize == 0)
+        return;
+    VkIndexType indexType = graphicsPipelines[CurrentContext().boundGraphicsPipelineIndex].pipelineInfo.indexType;
 
-    const u16 baseIndices[] =
+    for (int batchStart = 0; batchStart < quadCount; batchStart += batchSize)
     {
-        0, 3, 2, 2, 1, 0
-    };
+        int batchCount = std::min(batchSize, quadCount - batchStart);
+        diamond_vertex* quadVertices = ReserveVertices<diamond_vertex>(static_cast<u32>(batchCount * 4));
+        void* quadIndices = ReserveIndexMemory(static_cast<u32>(batchCount * 6));
 
-    for (int i = 0; i < quadCount; i++)
+        for (int j = 0; j < batchCount; j++)
+        {
+            int i = batchStart + j;
+            int vertexIndex = 4 * j;
+
+            int textureIndex = UseTexture(textureIndexes[i]);
+            glm::vec4 color = { 1.f, 1.f, 1.f, 1.f };
+            glm::vec4 texCoord = { 0.f, 0.f, 1.f, 1.f };
+            if (colors != nullptr)
+                color = colors[i];
+            if (texCoords != nullptr)
+                texCoord = texCoords[i];
+
+            quadVertices[vertexIndex] =     { {(-0.5f * offsetScales[i].z) + offsetScales[i].x, (-0.5f * offsetScales[i].w) + offsetScales[i].y, 0.f}, color, { texCoord.x, texCoord.w }, textureIndex };
+            quadVertices[vertexIndex + 1] = { {(0.5f * offsetScales[i].z) + offsetScales[i].x, (-0.5f * offsetScales[i].w) + offsetScales[i].y, 0.f}, color, { texCoord.z, texCoord.w }, textureIndex };
+            quadVertices[vertexIndex + 2] = { {(0.5f * offsetScales[i].z) + offsetScales[i].x, (0.5f * offsetScales[i].w) + offsetScales[i].y, 0.f}, color, { texCoord.z, texCoord.y }, textureIndex };
+            quadVertices[vertexIndex + 3] = { {(-0.5f * offsetScales[i].z) + offsetScales[i].x, (0.5f * offsetScales[i].w) + offsetScales[i].y, 0.f}, color, { texCoord.x, texCoord.y }, textureIndex };
+            WriteQuadIndices(quadIndices, static_cast<u32>(j), indexType);
+        }
+
+        DrawIndexed(static_cast<u32>(batchCount * 6), static_cast<u32>(batchCount * 4), -1, originTransform);
+    }
+}
+
+void diamond::WriteQuadIndices(void* destination, u32 quadIndex, VkIndexType indexType)
+{
+    u32 firstVertex = 4 * quadIndex;
+    u32 indices[] = { firstVertex, firstVertex + 3, firstVertex + 2, firstVertex + 2, firstVertex + 1, firstVertex };
+    if (indexType == VK_INDEX_TYPE_UINT16)
     {
-        int vertexIndex = 4 * i;
-        int indicesIndex = 6 * i;
+        u16* quadDestination = reinterpret_cast<u16*>(destination) + 6 * quadIndex;
+        for (int i = 0; i < 6; i++)
+            quadDestination[i] = static_cast<u16>(indices[i]);
+    }
+    else
+        memcpy(reinterpret_cast<u32*>(destination) + 6 * quadIndex, indices, sizeof(indices));
+}
+
+int diamond::GetQuadBatchSize(int quadCount)
+{
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex == -1 || quadCount <= 0)
+        return 0;
+
+    // indices are relative to the first vertex of each draw, so 16 bit indices can only reach 65536 / 4 quads per draw
+    if (graphicsPipelines[context.boundGraphicsPipelineIndex].pipelineInfo.indexType == VK_INDEX_TYPE_UINT16)
+        return std::min(quadCount, 16384);
+    return quadCount;
+}
+
+void* diamond::ReserveIndexMemory(u32 indexCount)
+{
+    diamond_recording_context& context = CurrentContext();
+    if (context.boundGraphicsPipelineIndex == -1)
+        return nullptr;
 
-        glm::vec4 color = { 1.f, 1.f, 1.f, 1.f };
-        glm::vec4 texCoord = { 0.f, 0.f, 1.f, 1.f };
-        if (colors != nullptr)
-            color = colors[i];
-        if (texCoords != nullptr)
-            texCoord = texCoords[i];
+    diamond_graphics_pipeline& pipeline = graphicsPipelines[context.boundGraphicsPipelineIndex];
+    diamond_recording_geometry& geometry = context.geometry[context.boundGraphicsPipelineIndex];
+    VkDeviceSize indexSize = GetIndexSize(pipeline.pipelineInfo.indexType);
+    VkDeviceSize offset = AllocateContextStreamMemory(context, pipeline.indexStream, geometry.indexChunk, indexSize * indexCount, indexSize);
 
-        quadVertices[vertexIndex] =     { {(-0.5f * offsetScales[i].z) + offsetScales[i].x, (-0.5f * offsetScales[i].w) + offsetScales[i].y, 0.f}, color, { texCoord.x, texCoord.w }, textureIndexes[i] };
-        quadVertices[vertexIndex + 1] = { {(0.5f * offsetScales[i].z) + offsetScales[i].x, (-0.5f * offsetScales[i].w) + offsetScales[i].y, 0.f}, color, { texCoord.z, texCoord.w }, textureIndexes[i] };
-        quadVertices[vertexIndex + 2] = { {(0.5f * offsetScales[i].z) + offsetScales[i].x, (0.5f * offsetScales[i].w) + offsetScales[i].y, 0.f}, color, { texCoord.z, texCoord.y }, textureIndexes[i] };
-        quadVertices[vertexIndex + 3] = { {(-0.5f * offsetScales[i].z) + offsetScales[i].x, (0.5f * offsetScales[i].w) + offsetScales[i].y, 0.f}, color, { texCoord.x, texCoord.y }, textureIndexes[i] };
-        quadIndices[indicesIndex] =     baseIndices[0] + vertexIndex;
-        quadIndices[indicesIndex + 1] = baseIndices[1] + vertexIndex;
-        quadIndices[indicesIndex + 2] = baseIndices[2] + vertexIndex;
-        quadIndices[indicesIndex + 3] = baseIndices[3] + vertexIndex;
-        quadIndices[indicesIndex + 4] = baseIndices[4] + vertexIndex;
-        quadIndices[indicesIndex + 5] = baseIndices[5] + vertexIndex;
+    if (geometry.indexChunk.buffer != geometry.indexBuffer)
+    {
+        vkCmdBindIndexBuffer(context.commandBuffers[currentFrameIndex], geometry.indexChunk.buffer, 0, pipeline.pipelineInfo.indexType);
+        geometry.indexBuffer = geometry.indexChunk.buffer;
     }
 
-    BindVertices(quadVertices.data(), static_cast<u32>(quadCount * 4));
-    BindIndices(quadIndices.data(), static_cast<u32>(quadCount * 6));
-    DrawIndexed(static_cast<u32>(quadCount * 6), static_cast<u32>(quadCount * 4), -1, originTransform);
+    geometry.boundIndexCount = static_cast<u32>(offset / indexSize) + indexCount;
+    return geometry.indexChunk.mapped + offset;
+}
+
+VkDeviceSize diamond::GetIndexSize(VkIndexType indexType)
+{
+    return indexType == VK_INDEX_TYPE_UINT32 ? sizeof(u32) : sizeof(u16);
 }
 
 glm::mat4 diamond::GenerateViewMatrix(glm::vec3 cameraPosition)
@@ -841,30 +1623,24 @@ void diamond::CreateFrameBuffers()
     }
 }
 
-void diamond::CopyBufferToImage(VkBuffer srcBuffer, VkImage dstImage, uint32_t width, uint32_t height)
+void diamond::CopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkDeviceSize srcOffset, VkImage dstImage, uint32_t width, uint32_t height, uint32_t mipLevel)
 {
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = srcOffset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.mipLevel = mipLevel;
     region.imageSubresource.baseArrayLayer = 0;
     region.imageSubresource.layerCount = 1;
     region.imageOffset = { 0, 0, 0 };
     region.imageExtent = { width, height, 1 };
 
     vkCmdCopyBufferToImage(commandBuffer, srcBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    EndSingleTimeCommands(commandBuffer);
 }
 
-void diamond::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
+void diamond::TransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
 {
-    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.oldLayout = oldLayout;
@@ -874,7 +1650,7 @@ void diamond::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayou
     barrier.image = image;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
 
@@ -920,11 +1696,9 @@ void diamond::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayou
         0, nullptr,
         1, &barrier
     );
-
-    EndSingleTimeCommands(commandBuffer);
 }
 
-void diamond::CreateImage(uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, VkImageLayout initialLayout)
+void diamond::CreateImage(uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, diamond_allocation& imageMemory, VkImageLayout initialLayout)
 {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -948,19 +1722,16 @@ void diamond::CreateImage(uint32_t width, uint32_t height, VkFormat format, uint
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(logicalDevice, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    imageMemory = AllocateMemory(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tiling == VK_IMAGE_TILING_OPTIMAL, false);
 
-    result = vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &imageMemory);
+    result = vkBindImageMemory(logicalDevice, image, imageMemory.memory, imageMemory.offset);
     Assert(result == VK_SUCCESS);
-
-    vkBindImageMemory(logicalDevice, image, imageMemory, 0);
 }
 
-VkImageView diamond::CreateTextureImage(const char* imagePath, VkImage& image, VkDeviceMemory& imageMemory, int& width, int& height)
+VkImageView diamond::CreateTextureImage(const char* imagePath, VkImage& image, diamond_allocation& imageMemory, int& width, int& height)
 {
+    DIAMOND_PROFILE_FUNCTION();
+
     int channels;
     stbi_uc* pixels = stbi_load(imagePath, &width, &height, &channels, STBI_rgb_alpha);
     Assert(pixels != nullptr)
@@ -971,124 +1742,635 @@ VkImageView diamond::CreateTextureImage(const char* imagePath, VkImage& image, V
     return view;
 }
 
-VkImageView diamond::CreateTextureImage(void* data, VkImage& image, VkDeviceMemory& imageMemory, int width, int height)
+VkImageView diamond::CreateTextureImage(void* data, VkImage& image, diamond_allocation& imageMemory, int width, int height, const std::vector<u8>* mipChain, VkFormat format)
 {
-    VkDeviceSize imageSize = width * height * 4;
+    DIAMOND_PROFILE_FUNCTION();
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    u32 blockExtent, blockSize;
+    bool knownFormat = GetTextureFormatInfo(format, blockExtent, blockSize);
+    Assert(knownFormat && blockExtent == 1); // compressed data has to come with its own levels
+
+    // the mips are built on the cpu since the transfer queue can't blit
+    u32 mipLevels = GetMipLevelCount(width, height);
+    std::vector<u8> generatedMipChain;
+    if (mipChain == nullptr && mipLevels > 1)
+    {
+        GenerateMipChain(static_cast<const u8*>(data), width, height, format, generatedMipChain);
+        mipChain = &generatedMipChain;
+    }
+
+    std::vector<const void*> levels = { data };
+    const u8* level = mipLevels > 1 ? mipChain->data() : nullptr;
+    for (u32 i = 1; i < mipLevels; i++)
+    {
+        levels.push_back(level);
+        level += GetTextureLevelSize(format, std::max(width >> i, 1), std::max(height >> i, 1));
+    }
+
+    return CreateTextureImage(levels.data(), mipLevels, format, width, height, image, imageMemory);
+}
 
-    MapMemory(data, sizeof(stbi_uc), static_cast<u32>(imageSize), stagingBufferMemory, 0);
+VkImageView diamond::CreateTextureImage(const void* const* levels, u32 mipLevels, VkFormat format, int width, int height, VkImage& image, diamond_allocation& imageMemory)
+{
+    CreateImage(width, height, format, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
 
-    CreateImage(width, height, VK_FORMAT_R8G8B8A8_SRGB, 1, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+    // recorded into the pending upload batch, which is submitted before any frame that could sample the texture. Each level is
+    // staged on its own so the copies stay aligned to the block size, and staging may submit the batch holding the previous copies,
+    // in which case the remaining levels are copied by the next one
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    for (u32 i = 0; i < mipLevels; i++)
+    {
+        int levelWidth = std::max(width >> i, 1);
+        int levelHeight = std::max(height >> i, 1);
+        VkBuffer stagingBuffer;
+        VkDeviceSize stagingOffset = StageUploadData(levels[i], GetTextureLevelSize(format, levelWidth, levelHeight), stagingBuffer);
+        commandBuffer = GetUploadCommandBuffer();
 
-    TransitionImageLayout(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        if (i == 0)
+            TransitionImageLayout(commandBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-    CopyBufferToImage(stagingBuffer, image, static_cast<u32>(width), static_cast<u32>(height));
+        CopyBufferToImage(commandBuffer, stagingBuffer, stagingOffset, image, static_cast<u32>(levelWidth), static_cast<u32>(levelHeight), i);
+    }
 
-    TransitionImageLayout(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    ReleaseUploadedImage(commandBuffer, image);
 
-    vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-    vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+    // single channel textures are masks, so they sample as white with the channel in alpha
+    VkComponentMapping components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+    if (format == VK_FORMAT_R8_UNORM || format == VK_FORMAT_R8_SRGB || format == VK_FORMAT_BC4_UNORM_BLOCK || format == VK_FORMAT_EAC_R11_UNORM_BLOCK)
+        components = { VK_COMPONENT_SWIZZLE_ONE, VK_COMPONENT_SWIZZLE_ONE, VK_COMPONENT_SWIZZLE_ONE, VK_COMPONENT_SWIZZLE_R };
 
-    return CreateImageView(image, VK_FORMAT_R8G8B8A8_SRGB, 1);
+    return CreateImageView(image, format, mipLevels, VK_IMAGE_ASPECT_COLOR_BIT, components);
 }
 
-void diamond::CreateTextureSampler()
+bool diamond::GetTextureFormatInfo(VkFormat format, u32& blockExtent, u32& blockSize)
 {
-    VkPhysicalDeviceProperties properties{};
-    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    blockExtent = 1;
+    switch (format)
+    {
+        case VK_FORMAT_R8_UNORM:
+        case VK_FORMAT_R8_SRGB:
+        {
+            blockSize = 1;
+        } break;
 
-    VkSamplerCreateInfo samplerInfo{};
-    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
-    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable = VK_FALSE;
-    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    samplerInfo.mipLodBias = 0.0f;
-    samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+        case VK_FORMAT_R8G8_UNORM:
+        case VK_FORMAT_R8G8_SRGB:
+        {
+            blockSize = 2;
+        } break;
 
-    VkResult result = vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &textureSampler);
-    Assert(result == VK_SUCCESS)
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+        {
+            blockSize = 4;
+        } break;
+
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+        case VK_FORMAT_BC4_SNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+        case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+        {
+            blockExtent = 4;
+            blockSize = 8;
+        } break;
+
+        case VK_FORMAT_BC2_UNORM_BLOCK:
+        case VK_FORMAT_BC2_SRGB_BLOCK:
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC5_SNORM_BLOCK:
+        case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+        case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+        case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+        case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+        {
+            blockExtent = 4;
+            blockSize = 16;
+        } break;
+
+        default:
+            return false;
+    }
+    return true;
 }
 
-void diamond::CreateColorResources()
+VkDeviceSize diamond::GetTextureLevelSize(VkFormat format, int width, int height)
 {
-    VkFormat colorFormat = swapChain.swapChainImageFormat;
+    u32 blockExtent, blockSize;
+    bool knownFormat = GetTextureFormatInfo(format, blockExtent, blockSize);
+    Assert(knownFormat);
+    VkDeviceSize blocksWide = (static_cast<VkDeviceSize>(width) + blockExtent - 1) / blockExtent;
+    VkDeviceSize blocksHigh = (static_cast<VkDeviceSize>(height) + blockExtent - 1) / blockExtent;
+    return blocksWide * blocksHigh * blockSize;
+}
 
-    CreateImage(swapChain.swapChainExtent.width, swapChain.swapChainExtent.height, colorFormat, 1, msaaSamples, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
-    colorImageView = CreateImageView(colorImage, colorFormat, 1);
+u32 diamond::GetMipLevelCount(int width, int height)
+{
+    u32 mipLevels = 1;
+    for (int size = std::max(width, height); size > 1; size /= 2)
+        mipLevels++;
+    return mipLevels;
 }
 
-void diamond::CreateDepthResources()
+void diamond::GenerateMipChain(const u8* pixels, int width, int height, VkFormat format, std::vector<u8>& mipChain)
 {
-    VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+    DIAMOND_PROFILE_FUNCTION();
 
-    CreateImage(swapChain.swapChainExtent.width, swapChain.swapChainExtent.height, depthFormat, 1, msaaSamples, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-    depthImageView = CreateImageView(depthImage, depthFormat, 1, VK_IMAGE_ASPECT_DEPTH_BIT);
+    u32 blockExtent, bytesPerPixel;
+    bool knownFormat = GetTextureFormatInfo(format, blockExtent, bytesPerPixel);
+    Assert(knownFormat && blockExtent == 1);
+
+    // srgb color channels are averaged in linear space, while alpha is always stored linearly
+    bool srgb = format == VK_FORMAT_R8_SRGB || format == VK_FORMAT_R8G8_SRGB || format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB;
+    u32 srgbChannels = srgb ? std::min(bytesPerPixel, 3u) : 0;
+
+    // linear value of every srgb code, and of the midpoints between neighbouring codes so that encoding rounds to the nearest code
+    struct srgb_tables
+    {
+        f32 decode[256];
+        f32 midpoints[255];
+    };
+    static const srgb_tables tables = []()
+    {
+        auto toLinear = [](f32 value) { return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f); };
+        srgb_tables result;
+        for (int i = 0; i < 256; i++)
+            result.decode[i] = toLinear(i / 255.f);
+        for (int i = 0; i < 255; i++)
+            result.midpoints[i] = toLinear((i + 0.5f) / 255.f);
+        return result;
+    }();
+
+    size_t chainSize = 0;
+    for (int mipWidth = width, mipHeight = height; mipWidth > 1 || mipHeight > 1;)
+    {
+        mipWidth = std::max(mipWidth / 2, 1);
+        mipHeight = std::max(mipHeight / 2, 1);
+        chainSize += static_cast<size_t>(mipWidth) * mipHeight * bytesPerPixel;
+    }
+    mipChain.resize(chainSize);
+
+    // every level is a 2x2 box filter of the previous one, which is what a linear blit would produce since it filters srgb formats
+    // after decoding them. On odd sized axes the last texel covers 3 source pixels, so that no row or column is dropped
+    const u8* source = pixels;
+    u8* destination = mipChain.data();
+    int sourceWidth = width;
+    int sourceHeight = height;
+    while (sourceWidth > 1 || sourceHeight > 1)
+    {
+        int mipWidth = std::max(sourceWidth / 2, 1);
+        int mipHeight = std::max(sourceHeight / 2, 1);
+        for (int y = 0; y < mipHeight; y++)
+        {
+            const u8* rows[3];
+            int rowCount = (sourceHeight & 1) && sourceHeight > 1 && y == mipHeight - 1 ? 3 : 2;
+            for (int r = 0; r < rowCount; r++)
+                rows[r] = source + static_cast<size_t>(std::min(2 * y + r, sourceHeight - 1)) * sourceWidth * bytesPerPixel;
+
+            for (int x = 0; x < mipWidth; x++)
+            {
+                int columns[3];
+                int columnCount = (sourceWidth & 1) && sourceWidth > 1 && x == mipWidth - 1 ? 3 : 2;
+                for (int i = 0; i < columnCount; i++)
+                    columns[i] = std::min(2 * x + i, sourceWidth - 1) * bytesPerPixel;
+
+                int count = rowCount * columnCount;
+                u8* texel = destination + (static_cast<size_t>(y) * mipWidth + x) * bytesPerPixel;
+                for (u32 c = 0; c < srgbChannels; c++)
+                {
+                    f32 linear = 0.f;
+                    for (int r = 0; r < rowCount; r++)
+                        for (int i = 0; i < columnCount; i++)
+                            linear += tables.decode[rows[r][columns[i] + c]];
+                    linear /= count;
+                    texel[c] = static_cast<u8>(std::upper_bound(tables.midpoints, tables.midpoints + 255, linear) - tables.midpoints);
+                }
+                for (u32 c = srgbChannels; c < bytesPerPixel; c++)
+                {
+                    int sum = 0;
+                    for (int r = 0; r < rowCount; r++)
+                        for (int i = 0; i < columnCount; i++)
+                            sum += rows[r][columns[i] + c];
+                    texel[c] = static_cast<u8>((sum + count / 2) / count);
+                }
+            }
+        }
+
+        source = destination;
+        destination += static_cast<size_t>(mipWidth) * mipHeight * bytesPerPixel;
+        sourceWidth = mipWidth;
+        sourceHeight = mipHeight;
+    }
 }
 
-VkImageView diamond::CreateImageView(VkImage image, VkFormat format, u32 mipLevels, VkImageAspectFlags aspectFlags)
+void diamond::GenerateComputeMips(VkCommandBuffer commandBuffer)
 {
-    VkImageViewCreateInfo viewInfo{};
-    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo.image = image;
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = format;
-    viewInfo.subresourceRange.aspectMask = aspectFlags;
-    viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = mipLevels;
-    viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
+    for (int i = 0; i < computePipelines.size(); i++)
+    {
+        if (!computePipelines[i].enabled)
+            continue;
 
-    VkImageView view;
-    VkResult result = vkCreateImageView(logicalDevice, &viewInfo, nullptr, &view);
-    Assert(result == VK_SUCCESS);
+        for (int j = 0; j < computePipelines[i].textureIndexes.size(); j++)
+        {
+            diamond_texture& texture = textureArray[computePipelines[i].textureIndexes[j]];
+            if (!texture.mipsDirty)
+                continue;
+            texture.mipsDirty = false;
+
+            VkFormatProperties formatProperties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, texture.format, &formatProperties);
+            VkFilter filter = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+            // the whole image stays in the general layout, which the compute queue writes it in
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = texture.image;
+            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            barrier.subresourceRange.baseMipLevel = 0;
+            barrier.subresourceRange.levelCount = texture.mipLevels;
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount = 1;
+
+            // the compute results are already visible to transfers through the semaphore wait, so this only orders the blits after the previous frame's draws
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+            int mipWidth = texture.width;
+            int mipHeight = texture.height;
+            barrier.subresourceRange.levelCount = 1;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            for (u32 level = 1; level < texture.mipLevels; level++)
+            {
+                int nextWidth = std::max(mipWidth / 2, 1);
+                int nextHeight = std::max(mipHeight / 2, 1);
+
+                VkImageBlit blit{};
+                blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+                blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+                blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+                blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+                vkCmdBlitImage(commandBuffer, texture.image, VK_IMAGE_LAYOUT_GENERAL, texture.image, VK_IMAGE_LAYOUT_GENERAL, 1, &blit, filter);
+
+                // the next blit reads the level which was just written
+                barrier.subresourceRange.baseMipLevel = level;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+                mipWidth = nextWidth;
+                mipHeight = nextHeight;
+            }
 
-    return view;
+            barrier.subresourceRange.baseMipLevel = 0;
+            barrier.subresourceRange.levelCount = texture.mipLevels;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+    }
 }
 
-void diamond::CreateCommandBuffers()
+void diamond::TextureLoadWorker()
 {
-    commandBuffers.resize(swapChain.swapChainFrameBuffers.size());
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (u32)commandBuffers.size();
+    diamond_profiler::SetThreadName("Texture loader");
+    while (true)
+    {
+        diamond_texture_load load;
+        {
+            std::unique_lock<std::mutex> lock(textureLoadMutex);
+            textureLoadCondition.wait(lock, [this]() { return stopTextureLoads || !queuedTextureLoads.empty(); });
+            if (stopTextureLoads)
+                return;
+            load = std::move(queuedTextureLoads.front());
+            queuedTextureLoads.pop_front();
+        }
 
-    VkResult result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, commandBuffers.data());
-    Assert(result == VK_SUCCESS);
+        if (load.compressed)
+            load.failed = !ReadCompressedTexture(load);
+        else
+        {
+            DIAMOND_PROFILE_SCOPE("DecodeTexture");
+            int channels;
+            load.pixels = stbi_load(load.filePath.c_str(), &load.width, &load.height, &channels, STBI_rgb_alpha);
+            load.failed = load.pixels == nullptr;
+            if (!load.failed)
+                GenerateMipChain(load.pixels, load.width, load.height, VK_FORMAT_R8G8B8A8_SRGB, load.mipChain);
+        }
+
+        std::lock_guard<std::mutex> lock(textureLoadMutex);
+        decodedTextureLoads.push_back(std::move(load));
+    }
 }
 
-void diamond::UpdatePerFrameBuffer(u32 imageIndex)
+void diamond::ProcessTextureLoads()
 {
-    f32 aspect = swapChain.swapChainExtent.width / (f32) swapChain.swapChainExtent.height;
+    DIAMOND_PROFILE_FUNCTION();
 
-    f32 zn = 0.1f;
-    f32 zf = 50.f;
-    switch (cameraMode)
+    // swap in the textures whose copies have finished
+    for (int i = 0; i < uploadingTextures.size(); i++)
     {
-        default:
-        case diamond_camera_mode::OrthographicViewportDependent:
-            cameraProjMatrix = glm::transpose(glm::ortho(-0.5f * swapChain.swapChainExtent.width, 0.5f * swapChain.swapChainExtent.width, 0.5f * swapChain.swapChainExtent.height, -0.5f * swapChain.swapChainExtent.height, zn, zf));
-            break;
-        case diamond_camera_mode::OrthographicViewportIndependent:
-            cameraProjMatrix = glm::transpose(glm::ortho(-0.5f * cameraDimensions.x, 0.5f * cameraDimensions.x, 0.5f * cameraDimensions.y, -0.5f * cameraDimensions.y, zn, zf));
-            break;
-        case diamond_camera_mode::FlatOrthographicViewportDependent:
+        diamond_texture& texture = textureArray[uploadingTextures[i]];
+        if (IsUploadComplete(texture.uploadHandle))
         {
-            f32 l = -0.5f * swapChain.swapChainExtent.width;
+            texture.loading = false;
+            QueueTextureDescriptorWrite(uploadingTextures[i]);
+            uploadingTextures.erase(uploadingTextures.begin() + i);
+            i--;
+        }
+    }
+
+    std::vector<diamond_texture_load> decoded;
+    {
+        std::lock_guard<std::mutex> lock(textureLoadMutex);
+        decoded.swap(decodedTextureLoads);
+    }
+
+    // the upload manager is only used from this thread, so the workers hand their pixels over instead of uploading them
+    for (int i = 0; i < decoded.size(); i++)
+    {
+        diamond_texture& texture = textureArray[decoded[i].textureId];
+        if (texture.id == -1 || texture.generation != decoded[i].generation) // unregistered while it was being decoded
+        {
+            stbi_image_free(decoded[i].pixels);
+            continue;
+        }
+
+        // the default texture stays bound in place of images which couldn't be read, and they aren't loaded again
+        if (decoded[i].failed || (decoded[i].compressed && !IsTextureFormatSupported(decoded[i].format)))
+        {
+            texture.loading = false;
+            texture.failed = true;
+            continue;
+        }
+
+        if (decoded[i].compressed)
+        {
+            std::vector<const void*> levels(decoded[i].levelOffsets.size());
+            for (int j = 0; j < levels.size(); j++)
+                levels[j] = decoded[i].contents.data() + decoded[i].levelOffsets[j];
+            texture.imageView = CreateTextureImage(levels.data(), static_cast<u32>(levels.size()), decoded[i].format, decoded[i].width, decoded[i].height, texture.image, texture.memory);
+            texture.mipLevels = static_cast<u32>(levels.size());
+        }
+        else
+        {
+            texture.imageView = CreateTextureImage((void*)decoded[i].pixels, texture.image, texture.memory, decoded[i].width, decoded[i].height, &decoded[i].mipChain);
+            texture.mipLevels = GetMipLevelCount(decoded[i].width, decoded[i].height);
+            stbi_image_free(decoded[i].pixels);
+        }
+        texture.uploadHandle = uploadBatches[currentUploadBatch].timelineValue;
+        texture.width = decoded[i].width;
+        texture.height = decoded[i].height;
+        uploadingTextures.push_back(decoded[i].textureId);
+    }
+}
+
+void diamond::QueueTextureLoad(u32 textureId)
+{
+    if (textureLoadThreads.empty())
+    {
+        // the main thread keeps recording frames and does the uploads
+        u32 threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        for (u32 i = 0; i < threadCount; i++)
+            textureLoadThreads.emplace_back(&diamond::TextureLoadWorker, this);
+    }
+
+    diamond_texture_load load;
+    load.textureId = textureId;
+    load.generation = textureArray[textureId].generation;
+    load.filePath = textureArray[textureId].filePath;
+    load.compressed = textureArray[textureId].compressed;
+    {
+        std::lock_guard<std::mutex> lock(textureLoadMutex);
+        queuedTextureLoads.push_back(load);
+    }
+    textureLoadCondition.notify_one();
+}
+
+void diamond::UpdateTextureResidency()
+{
+    DIAMOND_PROFILE_FUNCTION();
+
+    // evicted textures which were drawn with last frame are streamed back in
+    for (int i = 0; i < textureArray.size(); i++)
+    {
+        diamond_texture& texture = textureArray[i];
+        if (texture.evicted && textureLastUsed[i].load(std::memory_order_relaxed) >= graphicsTimelineValue)
+        {
+            texture.evicted = false;
+            texture.loading = true;
+            QueueTextureLoad(static_cast<u32>(i));
+        }
+    }
+
+    if (textureMemoryBudget == 0)
+        return;
+    u64 usage = GetTextureMemoryUsage();
+    if (usage <= textureMemoryBudget)
+        return;
+
+    // the default texture stands in for the others, and textures whose copies are still pending can't be released yet
+    std::vector<u32> candidates;
+    for (int i = 1; i < textureArray.size(); i++)
+    {
+        const diamond_texture& texture = textureArray[i];
+        if (texture.id != -1 && !texture.filePath.empty() && !texture.loading && !texture.evicted && texture.image != VK_NULL_HANDLE &&
+            textureLastUsed[i].load(std::memory_order_relaxed) < graphicsTimelineValue && IsUploadComplete(texture.uploadHandle))
+            candidates.push_back(static_cast<u32>(i));
+    }
+    std::sort(candidates.begin(), candidates.end(), [this](u32 a, u32 b)
+    {
+        return textureLastUsed[a].load(std::memory_order_relaxed) < textureLastUsed[b].load(std::memory_order_relaxed);
+    });
+
+    // sets of frames in flight may still point at an evicted image, but each frame rewrites its set before the deletion retires
+    for (int i = 0; i < candidates.size() && usage > textureMemoryBudget; i++)
+    {
+        diamond_texture& texture = textureArray[candidates[i]];
+        usage -= texture.memory.size;
+
+        diamond_deferred_deletion& deletion = DeferredDeletion();
+        deletion.imageViews.push_back(texture.imageView);
+        deletion.images.push_back(texture.image);
+        deletion.allocations.push_back(texture.memory);
+        texture.imageView = VK_NULL_HANDLE;
+        texture.image = VK_NULL_HANDLE;
+        texture.memory = {};
+        texture.evicted = true;
+        QueueTextureDescriptorWrite(candidates[i]);
+    }
+}
+
+void diamond::StopTextureLoads()
+{
+    {
+        std::lock_guard<std::mutex> lock(textureLoadMutex);
+        stopTextureLoads = true;
+    }
+    textureLoadCondition.notify_all();
+    for (int i = 0; i < textureLoadThreads.size(); i++)
+        textureLoadThreads[i].join();
+    textureLoadThreads.clear();
+
+    for (int i = 0; i < decodedTextureLoads.size(); i++)
+        stbi_image_free(decodedTextureLoads[i].pixels);
+    decodedTextureLoads.clear();
+    queuedTextureLoads.clear();
+}
+
+void diamond::CreateTextureSampler()
+{
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.anisotropyEnable = VK_TRUE;
+    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkResult result = vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &textureSampler);
+    Assert(result == VK_SUCCESS)
+}
+
+void diamond::CreateColorResources()
+{
+    VkFormat colorFormat = swapChain.swapChainImageFormat;
+
+    CreateImage(swapChain.swapChainExtent.width, swapChain.swapChainExtent.height, colorFormat, 1, msaaSamples, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
+    colorImageView = CreateImageView(colorImage, colorFormat, 1);
+}
+
+void diamond::CreateDepthResources()
+{
+    VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+
+    CreateImage(swapChain.swapChainExtent.width, swapChain.swapChainExtent.height, depthFormat, 1, msaaSamples, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+    depthImageView = CreateImageView(depthImage, depthFormat, 1, VK_IMAGE_ASPECT_DEPTH_BIT);
+}
+
+VkImageView diamond::CreateImageView(VkImage image, VkFormat format, u32 mipLevels, VkImageAspectFlags aspectFlags, VkComponentMapping components)
+{
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.components = components;
+    viewInfo.subresourceRange.aspectMask = aspectFlags;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VkImageView view;
+    VkResult result = vkCreateImageView(logicalDevice, &viewInfo, nullptr, &view);
+    Assert(result == VK_SUCCESS);
+
+    return view;
+}
+
+void diamond::CreateFrameCommandBuffers()
+{
+    // each frame in flight owns its own pool which gets reset as a whole once the frame's fence has signaled,
+    // so the per frame command buffers never need to be freed or reset individually
+    diamond_queue_family_indices indices = GetQueueFamilies(physicalDevice);
+    frameCommandPools.resize(MAX_FRAMES_IN_FLIGHT);
+    computeCommandPools.resize(MAX_FRAMES_IN_FLIGHT);
+    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    mainContext.commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    #if DIAMOND_IMGUI
+    overlayBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    #endif
+    computeBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = indices.graphicsFamily.value();
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        VkResult result = vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &frameCommandPools[i]);
+        Assert(result == VK_SUCCESS);
+
+        poolInfo.queueFamilyIndex = indices.computeFamily.value();
+        result = vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &computeCommandPools[i]);
+        Assert(result == VK_SUCCESS);
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frameCommandPools[i];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffers[i]);
+        Assert(result == VK_SUCCESS);
+
+        // rendering secondary command buffer
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &mainContext.commandBuffers[i]);
+        Assert(result == VK_SUCCESS);
+        #if DIAMOND_IMGUI
+        result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &overlayBuffers[i]);
+        Assert(result == VK_SUCCESS);
+        #endif
+
+        // primary compute shader buffer
+        allocInfo.commandPool = computeCommandPools[i];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &computeBuffers[i]);
+        Assert(result == VK_SUCCESS);
+    }
+}
+
+void diamond::UpdatePerFrameBuffer(int frameIndex)
+{
+    f32 aspect = swapChain.swapChainExtent.width / (f32) swapChain.swapChainExtent.height;
+
+    f32 zn = 0.1f;
+    f32 zf = 50.f;
+    switch (cameraMode)
+    {
+        default:
+        case diamond_camera_mode::OrthographicViewportDependent:
+            cameraProjMatrix = glm::transpose(glm::ortho(-0.5f * swapChain.swapChainExtent.width, 0.5f * swapChain.swapChainExtent.width, 0.5f * swapChain.swapChainExtent.height, -0.5f * swapChain.swapChainExtent.height, zn, zf));
+            break;
+        case diamond_camera_mode::OrthographicViewportIndependent:
+            cameraProjMatrix = glm::transpose(glm::ortho(-0.5f * cameraDimensions.x, 0.5f * cameraDimensions.x, 0.5f * cameraDimensions.y, -0.5f * cameraDimensions.y, zn, zf));
+            break;
+        case diamond_camera_mode::FlatOrthographicViewportDependent:
+        {
+            f32 l = -0.5f * swapChain.swapChainExtent.width;
             f32 r = 0.5f * swapChain.swapChainExtent.width;
             f32 b = 0.5f * swapChain.swapChainExtent.height;
             f32 t = -0.5f * swapChain.swapChainExtent.height;
@@ -1122,27 +2404,23 @@ void diamond::UpdatePerFrameBuffer(u32 imageIndex)
     diamond_frame_buffer_object fbo{};
     fbo.viewProj = cameraProjMatrix * cameraViewMatrix;
 
-    MapMemory(&fbo, sizeof(diamond_frame_buffer_object), 1, uniformBuffersMemory[imageIndex], 0);
+    MapMemory(&fbo, sizeof(diamond_frame_buffer_object), 1, uniformBuffersMemory[frameIndex], 0);
 }
 
 void diamond::CreateDescriptorPool()
 {
-    std::array<VkDescriptorPoolSize, 3> poolSizes{};
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<u32>(swapChain.swapChainImages.size());
+    poolSizes[0].descriptorCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<u32>(swapChain.swapChainImages.size() * textureArray.size());
-
-    // for imgui
-    poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[2].descriptorCount = static_cast<u32>(swapChain.swapChainImages.size());
+    poolSizes[1].descriptorCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT) * textureCapacity;
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<u32>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<u32>(swapChain.swapChainImages.size()) + 1;
-    poolInfo.flags = 0;
+    poolInfo.maxSets = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
 
     VkResult result = vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool);
     Assert(result == VK_SUCCESS);
@@ -1150,13 +2428,14 @@ void diamond::CreateDescriptorPool()
 
 void diamond::CreateComputeDescriptorPool(diamond_compute_pipeline& pipeline, int bufferCount, int imageCount)
 {
+    // one set per frame in flight so double buffered resources can be swapped
     VkDescriptorPoolSize bufferPoolSize = {};
     bufferPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    bufferPoolSize.descriptorCount = bufferCount;
+    bufferPoolSize.descriptorCount = bufferCount * MAX_FRAMES_IN_FLIGHT;
 
     VkDescriptorPoolSize imagePoolSize = {};
     imagePoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    imagePoolSize.descriptorCount = imageCount;
+    imagePoolSize.descriptorCount = imageCount * MAX_FRAMES_IN_FLIGHT;
 
     std::vector<VkDescriptorPoolSize> poolSizes;
     if (bufferCount > 0)
@@ -1168,7 +2447,7 @@ void diamond::CreateComputeDescriptorPool(diamond_compute_pipeline& pipeline, in
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<u32>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = 1;
+    poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
     poolInfo.flags = 0;
 
     VkResult result = vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &pipeline.descriptorPool);
@@ -1177,18 +2456,25 @@ void diamond::CreateComputeDescriptorPool(diamond_compute_pipeline& pipeline, in
 
 void diamond::CreateDescriptorSets()
 {
-    std::vector<VkDescriptorSetLayout> layouts(swapChain.swapChainImages.size(), descriptorSetLayout);
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
+    std::vector<u32> textureCounts(MAX_FRAMES_IN_FLIGHT, textureCapacity);
+    VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{};
+    countInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+    countInfo.descriptorSetCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
+    countInfo.pDescriptorCounts = textureCounts.data();
+
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = &countInfo;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<u32>(swapChain.swapChainImages.size());
+    allocInfo.descriptorSetCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
     allocInfo.pSetLayouts = layouts.data();
 
-    descriptorSets.resize(swapChain.swapChainImages.size());
+    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
     VkResult result = vkAllocateDescriptorSets(logicalDevice, &allocInfo, descriptorSets.data());
     Assert(result == VK_SUCCESS);
 
-    for (int i = 0; i < swapChain.swapChainImages.size(); i++)
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
         VkDescriptorBufferInfo bufferInfo{};
         bufferInfo.buffer = uniformBuffers[i];
@@ -1210,7 +2496,7 @@ void diamond::CreateDescriptorSets()
             VkDescriptorImageInfo imageInfo{};
             imageInfo.sampler = textureSampler;
 
-            if (textureArray[i].id != -1)
+            if (textureArray[i].id != -1 && !textureArray[i].loading && !textureArray[i].evicted && !textureArray[i].failed)
             {
                 imageInfo.imageLayout = textureArray[i].imageLayout;
                 imageInfo.imageView = textureArray[i].imageView;
@@ -1234,65 +2520,123 @@ void diamond::CreateDescriptorSets()
 
         vkUpdateDescriptorSets(logicalDevice, static_cast<u32>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
     }
+
+    // every registered texture has just been written
+    pendingTextureWrites.assign(MAX_FRAMES_IN_FLIGHT, {});
+}
+
+void diamond::QueueTextureDescriptorWrite(u32 textureId)
+{
+    // the sets of frames in flight can't be touched, so each frame writes its own set once it is being recorded again
+    for (int i = 0; i < pendingTextureWrites.size(); i++)
+        pendingTextureWrites[i].push_back(textureId);
+}
+
+void diamond::FlushTextureDescriptorWrites(int frameIndex)
+{
+    std::vector<u32>& pending = pendingTextureWrites[frameIndex];
+    if (pending.empty())
+        return;
+
+    std::vector<VkDescriptorImageInfo> images(pending.size());
+    std::vector<VkWriteDescriptorSet> descriptorWrites(pending.size());
+    for (int i = 0; i < pending.size(); i++)
+    {
+        // disabled, loading, evicted and failed textures point at the default texture
+        const diamond_texture& entry = textureArray[pending[i]];
+        const diamond_texture& texture = entry.id != -1 && !entry.loading && !entry.evicted && !entry.failed ? entry : textureArray[0];
+        images[i].sampler = textureSampler;
+        images[i].imageLayout = texture.imageLayout;
+        images[i].imageView = texture.imageView;
+
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = descriptorSets[frameIndex];
+        descriptorWrites[i].dstBinding = 1;
+        descriptorWrites[i].dstArrayElement = pending[i];
+        descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[i].descriptorCount = 1;
+        descriptorWrites[i].pImageInfo = &images[i];
+    }
+
+    vkUpdateDescriptorSets(logicalDevice, static_cast<u32>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    pending.clear();
 }
 
 void diamond::CreateComputeDescriptorSets(diamond_compute_pipeline& pipeline, int bufferCount, int imageCount, diamond_compute_buffer_info* bufferInfo)
 {
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, pipeline.descriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = pipeline.descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+    allocInfo.descriptorSetCount = static_cast<u32>(MAX_FRAMES_IN_FLIGHT);
+    allocInfo.pSetLayouts = layouts.data();
 
-    pipeline.descriptorSets.resize(1);
+    pipeline.descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
     VkResult result = vkAllocateDescriptorSets(logicalDevice, &allocInfo, pipeline.descriptorSets.data());
     Assert(result == VK_SUCCESS);
 
-    std::vector<VkDescriptorBufferInfo> bufferDescriptorList(bufferCount);
-    std::vector<VkDescriptorImageInfo> imageDescriptorList(imageCount);
-    std::vector<VkWriteDescriptorSet> descriptorWrites(bufferCount + imageCount);
-    for (int i = 0; i < bufferCount; i++)
-    {
-        if (bufferInfo[i].staging)
-            bufferDescriptorList[i].buffer = pipeline.deviceBuffers[i];
-        else
-            bufferDescriptorList[i].buffer = pipeline.buffers[i];
-        bufferDescriptorList[i].offset = 0;  
-        bufferDescriptorList[i].range = bufferInfo[i].size;
-
-        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[i].dstSet = pipeline.descriptorSets[0];
-        descriptorWrites[i].dstBinding = i;
-        descriptorWrites[i].dstArrayElement = 0;
-        descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        descriptorWrites[i].descriptorCount = 1;
-        descriptorWrites[i].pBufferInfo = &bufferDescriptorList[i];
-    }
-    for (int i = bufferCount; i < imageCount + bufferCount; i++)
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
     {
-        imageDescriptorList[i - bufferCount].imageView = textureArray[pipeline.textureIndexes[i - bufferCount]].imageView;
-        imageDescriptorList[i - bufferCount].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        std::vector<VkDescriptorBufferInfo> bufferDescriptorList(bufferCount);
+        std::vector<VkDescriptorImageInfo> imageDescriptorList(imageCount);
+        std::vector<VkWriteDescriptorSet> descriptorWrites(bufferCount + imageCount);
+        for (int i = 0; i < bufferCount; i++)
+        {
+            bufferDescriptorList[i].buffer = GetComputeDeviceBuffer(pipeline, i, frame);
+            bufferDescriptorList[i].offset = 0;  
+            bufferDescriptorList[i].range = bufferInfo[i].size;
+
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = pipeline.descriptorSets[frame];
+            descriptorWrites[i].dstBinding = i;
+            descriptorWrites[i].dstArrayElement = 0;
+            descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].pBufferInfo = &bufferDescriptorList[i];
+        }
+        for (int i = bufferCount; i < imageCount + bufferCount; i++)
+        {
+            const diamond_texture& texture = textureArray[pipeline.textureIndexes[i - bufferCount]];
+            imageDescriptorList[i - bufferCount].imageView = texture.storageView != VK_NULL_HANDLE ? texture.storageView : texture.imageView;
+            imageDescriptorList[i - bufferCount].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = pipeline.descriptorSets[frame];
+            descriptorWrites[i].dstBinding = i;
+            descriptorWrites[i].dstArrayElement = 0;
+            descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].pImageInfo = &imageDescriptorList[i - bufferCount];
+        }
 
-        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[i].dstSet = pipeline.descriptorSets[0];
-        descriptorWrites[i].dstBinding = i;
-        descriptorWrites[i].dstArrayElement = 0;
-        descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-        descriptorWrites[i].descriptorCount = 1;
-        descriptorWrites[i].pImageInfo = &imageDescriptorList[i - bufferCount];
+        vkUpdateDescriptorSets(logicalDevice, static_cast<u32>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
     }
-
-    vkUpdateDescriptorSets(logicalDevice, static_cast<u32>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
 #if DIAMOND_IMGUI
 void diamond::CleanupImGui()
 {
     ImGui_ImplVulkan_Shutdown();
+    vkDestroyDescriptorPool(logicalDevice, imguiDescriptorPool, nullptr);
+    imguiDescriptorPool = VK_NULL_HANDLE;
 }
 
 void diamond::CreateImGui()
 {
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = static_cast<u32>(swapChain.swapChainImages.size());
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = static_cast<u32>(swapChain.swapChainImages.size());
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+
+    VkResult result = vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &imguiDescriptorPool);
+    Assert(result == VK_SUCCESS);
+
     ImGui_ImplVulkan_InitInfo initInfo = ImGuiInitInfo();
     ImGui_ImplVulkan_Init(&initInfo, renderPass);
     VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
@@ -1309,7 +2653,7 @@ ImGui_ImplVulkan_InitInfo diamond::ImGuiInitInfo() {
     info.QueueFamily = GetQueueFamilies(physicalDevice).graphicsFamily.value();
     info.Queue = presentQueue;
     info.PipelineCache = VK_NULL_HANDLE;
-    info.DescriptorPool = descriptorPool;
+    info.DescriptorPool = imguiDescriptorPool;
     info.Allocator = NULL;
     info.MinImageCount = 2;
     info.ImageCount = static_cast<u32>(swapChain.swapChainImages.size());
@@ -1326,23 +2670,22 @@ void diamond::CleanupSwapChain()
         vkDestroyFramebuffer(logicalDevice, swapChain.swapChainFrameBuffers[i], nullptr);
     }
 
-    vkFreeCommandBuffers(logicalDevice, commandPool, static_cast<u32>(commandBuffers.size()), commandBuffers.data());
     // vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
     // vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
     // vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
 
     vkDestroyImageView(logicalDevice, colorImageView, nullptr);
     vkDestroyImage(logicalDevice, colorImage, nullptr);
-    vkFreeMemory(logicalDevice, colorImageMemory, nullptr);
+    FreeMemory(colorImageMemory);
 
     vkDestroyImageView(logicalDevice, depthImageView, nullptr);
     vkDestroyImage(logicalDevice, depthImage, nullptr);
-    vkFreeMemory(logicalDevice, depthImageMemory, nullptr);
+    FreeMemory(depthImageMemory);
 
     // for (int i = 0; i < swapChain.swapChainImages.size(); i++)
     // {
     //     vkDestroyBuffer(logicalDevice, uniformBuffers[i], nullptr);
-    //     vkFreeMemory(logicalDevice, uniformBuffersMemory[i], nullptr);
+    //     FreeMemory(uniformBuffersMemory[i]);
     // }
 
     //vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
@@ -1352,7 +2695,17 @@ void diamond::CleanupSwapChain()
         vkDestroyImageView(logicalDevice, swapChain.swapChainImageViews[i], nullptr);
     }
 
-    vkDestroySwapchainKHR(logicalDevice, swapChain.swapChain, nullptr);
+    if (headless)
+    {
+        for (int i = 0; i < swapChain.swapChainImages.size(); i++)
+        {
+            vkDestroyImage(logicalDevice, swapChain.swapChainImages[i], nullptr);
+            FreeMemory(offscreenImagesMemory[i]);
+        }
+        lastRenderedImageIndex = -1;
+    }
+    else
+        vkDestroySwapchainKHR(logicalDevice, swapChain.swapChain, nullptr);
 
     #if DIAMOND_IMGUI
     //CleanupImGui();
@@ -1361,14 +2714,17 @@ void diamond::CleanupSwapChain()
 
 void diamond::RecreateSwapChain()
 {
+    DIAMOND_PROFILE_FUNCTION();
+
     #if DIAMOND_DEBUG
     std::cerr << "Recreating swap chain" << std::endl;
     #endif
 
     // pause application on minimize (change later?)
     int width, height = 0;
-    glfwGetFramebufferSize(window, &width, &height);
-    while (width == 0 || height == 0)
+    if (!headless)
+        glfwGetFramebufferSize(window, &width, &height);
+    while (!headless && (width == 0 || height == 0))
     {
         glfwGetFramebufferSize(window, &width, &height);
         glfwWaitEvents();
@@ -1389,7 +2745,9 @@ void diamond::RecreateSwapChain()
     //CreateUniformBuffers();
     //CreateDescriptorPool();
     //CreateDescriptorSets();
-    CreateCommandBuffers();
+
+    // the image count may have changed and no old image is in flight anymore
+    imagesInFlight.assign(swapChain.swapChainImages.size(), VK_NULL_HANDLE);
 
     #if DIAMOND_IMGUI
     //CreateImGui();
@@ -1400,10 +2758,12 @@ void diamond::CleanupCompute(diamond_compute_pipeline& pipeline)
 {
     if (pipeline.enabled)
     {
-        vkDestroyPipeline(logicalDevice, pipeline.pipeline, nullptr);
-        vkDestroyPipelineLayout(logicalDevice, pipeline.pipelineLayout, nullptr);
-        vkDestroyDescriptorPool(logicalDevice, pipeline.descriptorPool, nullptr);
-        vkDestroyDescriptorSetLayout(logicalDevice, pipeline.descriptorSetLayout, nullptr);
+        // the frames in flight may still be dispatching with the pipeline
+        diamond_deferred_deletion& deletion = DeferredDeletion();
+        deletion.pipelines.push_back(pipeline.pipeline);
+        deletion.pipelineLayouts.push_back(pipeline.pipelineLayout);
+        deletion.descriptorPools.push_back(pipeline.descriptorPool);
+        deletion.descriptorSetLayouts.push_back(pipeline.descriptorSetLayout);
         
         pipeline.pipeline = VK_NULL_HANDLE;
         pipeline.pipelineLayout = VK_NULL_HANDLE;
@@ -1414,15 +2774,21 @@ void diamond::CleanupCompute(diamond_compute_pipeline& pipeline)
         {
             if (std::find(freedBuffers.begin(), freedBuffers.end(), pipeline.pipelineInfo.bufferInfoList[i].identifier) == freedBuffers.end())
             {
-                vkDestroyBuffer(logicalDevice, pipeline.buffers[i], nullptr);
-                vkFreeMemory(logicalDevice, pipeline.buffersMemory[i], nullptr);
-                vkDestroyBuffer(logicalDevice, pipeline.deviceBuffers[i], nullptr);
-                vkFreeMemory(logicalDevice, pipeline.deviceBuffersMemory[i], nullptr);
+                deletion.buffers.push_back(pipeline.buffers[i]);
+                deletion.allocations.push_back(pipeline.buffersMemory[i]);
+                deletion.buffers.push_back(pipeline.deviceBuffers[i]);
+                deletion.allocations.push_back(pipeline.deviceBuffersMemory[i]);
 
                 pipeline.buffers[i] = VK_NULL_HANDLE;
-                pipeline.buffersMemory[i] = VK_NULL_HANDLE;
                 pipeline.deviceBuffers[i] = VK_NULL_HANDLE;
-                pipeline.deviceBuffersMemory[i] = VK_NULL_HANDLE;
+
+                for (int f = 0; f < MAX_FRAMES_IN_FLIGHT - 1; f++)
+                {
+                    int frameBufferIndex = i * (MAX_FRAMES_IN_FLIGHT - 1) + f;
+                    deletion.buffers.push_back(pipeline.frameDeviceBuffers[frameBufferIndex]);
+                    deletion.allocations.push_back(pipeline.frameDeviceBuffersMemory[frameBufferIndex]);
+                    pipeline.frameDeviceBuffers[frameBufferIndex] = VK_NULL_HANDLE;
+                }
 
                 freedBuffers.push_back(pipeline.pipelineInfo.bufferInfoList[i].identifier);
             }
@@ -1430,13 +2796,23 @@ void diamond::CleanupCompute(diamond_compute_pipeline& pipeline)
 
         for (int i = 0; i < pipeline.textureIndexes.size(); i++)
         {
+            // images shared through their identifier are freed along with the last pipeline using them, since the slot may be reused afterwards
+            bool shared = false;
+            for (int j = 0; j < computePipelines.size() && !shared; j++)
+            {
+                const diamond_compute_pipeline& other = computePipelines[j];
+                shared = &other != &pipeline && other.enabled && std::find(other.textureIndexes.begin(), other.textureIndexes.end(), pipeline.textureIndexes[i]) != other.textureIndexes.end();
+            }
+
             diamond_texture& entry = textureArray[pipeline.textureIndexes[i]];
-            if (entry.id != -1) // todo: texture id 'free list'
+            if (entry.id != -1 && !shared)
             {
-                vkDestroyImageView(logicalDevice, entry.imageView, nullptr);
-                vkDestroyImage(logicalDevice, entry.image, nullptr);
-                vkFreeMemory(logicalDevice, entry.memory, nullptr);
-                entry.id = -1;
+                deletion.imageViews.push_back(entry.imageView);
+                if (entry.storageView != VK_NULL_HANDLE)
+                    deletion.imageViews.push_back(entry.storageView);
+                deletion.images.push_back(entry.image);
+                deletion.allocations.push_back(entry.memory);
+                ReleaseTextureSlot(static_cast<u32>(pipeline.textureIndexes[i]));
             }
         }
 
@@ -1453,22 +2829,25 @@ void diamond::CleanupGraphics(diamond_graphics_pipeline& pipeline)
 {
     if (pipeline.enabled)
     {
-        vkDestroyBuffer(logicalDevice, pipeline.vertexBuffer, nullptr);
-        vkFreeMemory(logicalDevice, pipeline.vertexBufferMemory, nullptr);
-        vkDestroyBuffer(logicalDevice, pipeline.indexBuffer, nullptr);
-        vkFreeMemory(logicalDevice, pipeline.indexBufferMemory, nullptr);
-        vkDestroyPipeline(logicalDevice, pipeline.pipeline, nullptr);
-        vkDestroyPipelineLayout(logicalDevice, pipeline.pipelineLayout, nullptr);
+        CleanupStreamBuffer(pipeline.vertexStream);
+        CleanupStreamBuffer(pipeline.indexStream);
+        diamond_deferred_deletion& deletion = DeferredDeletion();
+        deletion.pipelines.push_back(pipeline.pipeline);
+        deletion.pipelineLayouts.push_back(pipeline.pipelineLayout);
         pipeline.enabled = false;
     }
 }
 
 void diamond::RecreateCompute(diamond_compute_pipeline& pipeline, diamond_compute_pipeline_create_info createInfo)
 {
+    DIAMOND_PROFILE_FUNCTION();
+
     pipeline.buffers.resize(createInfo.bufferCount);
     pipeline.buffersMemory.resize(createInfo.bufferCount);
     pipeline.deviceBuffers.resize(createInfo.bufferCount);
     pipeline.deviceBuffersMemory.resize(createInfo.bufferCount);
+    pipeline.frameDeviceBuffers.resize(createInfo.bufferCount * (MAX_FRAMES_IN_FLIGHT - 1), VK_NULL_HANDLE);
+    pipeline.frameDeviceBuffersMemory.resize(createInfo.bufferCount * (MAX_FRAMES_IN_FLIGHT - 1));
 
     for (int i = 0; i < createInfo.bufferCount; i++)
     {
@@ -1492,6 +2871,11 @@ void diamond::RecreateCompute(diamond_compute_pipeline& pipeline, diamond_comput
                             pipeline.buffersMemory[i] = computePipelines[j].buffersMemory[k];
                             pipeline.deviceBuffers[i] = computePipelines[j].deviceBuffers[k];
                             pipeline.deviceBuffersMemory[i] = computePipelines[j].deviceBuffersMemory[k];
+                            for (int f = 0; f < MAX_FRAMES_IN_FLIGHT - 1; f++)
+                            {
+                                pipeline.frameDeviceBuffers[i * (MAX_FRAMES_IN_FLIGHT - 1) + f] = computePipelines[j].frameDeviceBuffers[k * (MAX_FRAMES_IN_FLIGHT - 1) + f];
+                                pipeline.frameDeviceBuffersMemory[i * (MAX_FRAMES_IN_FLIGHT - 1) + f] = computePipelines[j].frameDeviceBuffersMemory[k * (MAX_FRAMES_IN_FLIGHT - 1) + f];
+                            }
                             found = true;
                             break;
                         }
@@ -1514,7 +2898,18 @@ void diamond::RecreateCompute(diamond_compute_pipeline& pipeline, diamond_comput
             if (createInfo.bufferInfoList[i].staging)
             {
                 VkBufferUsageFlags deviceFlags = baseFlags | (createInfo.bufferInfoList[i].staging ? VK_BUFFER_USAGE_TRANSFER_DST_BIT : 0) | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-                CreateBuffer(createInfo.bufferInfoList[i].size, deviceFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pipeline.deviceBuffers[i], pipeline.deviceBuffersMemory[i]);
+                if (IsComputeBufferDoubleBuffered(createInfo.bufferInfoList[i]))
+                {
+                    // one copy per frame in flight, shared between both queue families so no ownership transfers are needed
+                    CreateBuffer(createInfo.bufferInfoList[i].size, deviceFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pipeline.deviceBuffers[i], pipeline.deviceBuffersMemory[i], true);
+                    for (int f = 0; f < MAX_FRAMES_IN_FLIGHT - 1; f++)
+                    {
+                        int frameBufferIndex = i * (MAX_FRAMES_IN_FLIGHT - 1) + f;
+                        CreateBuffer(createInfo.bufferInfoList[i].size, deviceFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pipeline.frameDeviceBuffers[frameBufferIndex], pipeline.frameDeviceBuffersMemory[frameBufferIndex], true);
+                    }
+                }
+                else
+                    CreateBuffer(createInfo.bufferInfoList[i].size, deviceFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pipeline.deviceBuffers[i], pipeline.deviceBuffersMemory[i]);
             }
         }
     }
@@ -1572,18 +2967,34 @@ void diamond::RecreateCompute(diamond_compute_pipeline& pipeline, diamond_comput
                 }
             }
 
-            CreateImage(createInfo.imageInfoList[i].width, createInfo.imageInfoList[i].height, format, 1, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, newTex.image, newTex.memory);
-            TransitionImageLayout(newTex.image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-            TransitionImageLayout(newTex.image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+            newTex.format = format;
+            newTex.width = createInfo.imageInfoList[i].width;
+            newTex.height = createInfo.imageInfoList[i].height;
+            VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+            if (createInfo.imageInfoList[i].generateMips)
+            {
+                VkFormatProperties formatProperties;
+                vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+                Assert((formatProperties.optimalTilingFeatures & (VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT)) == (VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT));
+                newTex.mipLevels = GetMipLevelCount(newTex.width, newTex.height);
+                usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            }
+
+            CreateImage(newTex.width, newTex.height, format, newTex.mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, newTex.image, newTex.memory);
+            // the transfer family may not support these stages, and creating compute pipelines is not expected to happen mid game
+            VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+            TransitionImageLayout(commandBuffer, newTex.image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+            TransitionImageLayout(commandBuffer, newTex.image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+            EndSingleTimeCommands(commandBuffer);
 
-            newTex.imageView = CreateImageView(newTex.image, format, 1);
+            newTex.imageView = CreateImageView(newTex.image, format, newTex.mipLevels);
+            if (newTex.mipLevels > 1) // storage image views can only cover a single level
+                newTex.storageView = CreateImageView(newTex.image, format, 1);
             newTex.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-            newTex.id = static_cast<u32>(textureArray.size());
-            pipeline.textureIndexes.push_back(static_cast<int>(textureArray.size()));
-            textureArray.push_back(newTex);
+            AddTexture(newTex);
+            pipeline.textureIndexes.push_back(static_cast<int>(newTex.id));
         }
     }
-    SyncTextureUpdates();
 
     CreateComputeDescriptorSetLayout(pipeline, createInfo.bufferCount, createInfo.imageCount);
     CreateComputePipeline(pipeline);
@@ -1624,25 +3035,50 @@ diamond_queue_family_indices diamond::GetQueueFamilies(VkPhysicalDevice device)
     vkGetPhysicalDeviceQueueFamilyProperties(device, &supportedQueueFamilyCount, supportedQueueFamilies.data());
 
     int i = 0;
+    bool dedicatedCompute = false;
     for (const auto& family : supportedQueueFamilies)
     {
-        if (indices.IsComplete())
+        if (indices.IsComplete() && (!asyncCompute || dedicatedCompute))
             break;
 
-        if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT && !indices.graphicsFamily.has_value())
             indices.graphicsFamily = i;
 
-        if (family.queueFlags & VK_QUEUE_COMPUTE_BIT)
-            indices.computeFamily = i;
+        // async compute prefers a family without graphics support, which usually maps to dedicated hardware queues that run alongside rendering
+        if (family.queueFlags & VK_QUEUE_COMPUTE_BIT && !dedicatedCompute)
+        {
+            dedicatedCompute = !(family.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+            if (!indices.computeFamily.has_value() || (asyncCompute && dedicatedCompute))
+                indices.computeFamily = i;
+        }
 
+        // without a surface the graphics queue doubles as the present queue, which is never presented from
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-        if (presentSupport)
+        if (headless)
+            presentSupport = family.queueFlags & VK_QUEUE_GRAPHICS_BIT;
+        else
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        if (presentSupport && !indices.presentFamily.has_value())
             indices.presentFamily = i;
         
         i++;
     }
 
+    // uploads prefer a family without graphics or compute support, which usually maps to the copy engines. Families with a coarser
+    // transfer granularity would restrict the regions uploads can copy, so they are skipped
+    for (u32 j = 0; j < supportedQueueFamilyCount; j++)
+    {
+        const VkQueueFamilyProperties& family = supportedQueueFamilies[j];
+        VkExtent3D granularity = family.minImageTransferGranularity;
+        if (family.queueFlags & VK_QUEUE_TRANSFER_BIT && !(family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && granularity.width == 1 && granularity.height == 1 && granularity.depth == 1)
+        {
+            indices.transferFamily = j;
+            break;
+        }
+    }
+    if (!indices.transferFamily.has_value())
+        indices.transferFamily = indices.graphicsFamily;
+
     return indices;
 }
 
@@ -1713,13 +3149,21 @@ void diamond::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize si
     EndSingleTimeCommands(commandBuffer);
 }
 
-void diamond::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+void diamond::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, diamond_allocation& bufferMemory, bool sharedWithCompute, bool transient)
 {
+    u32 families[] = { queueFamilies.graphicsFamily.value(), queueFamilies.computeFamily.value() };
+
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size; // really shouldnt have more vertices than this
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (sharedWithCompute && families[0] != families[1])
+    {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = 2;
+        bufferInfo.pQueueFamilyIndices = families;
+    }
 
     VkResult result = vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &buffer);
     Assert(result == VK_SUCCESS);
@@ -1727,535 +3171,1994 @@ void diamond::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemory
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(logicalDevice, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-    
-    result = vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &bufferMemory);
-    Assert(result == VK_SUCCESS);
+    bufferMemory = AllocateMemory(memRequirements, properties, false, transient);
 
-    result = vkBindBufferMemory(logicalDevice, buffer, bufferMemory, 0);
+    result = vkBindBufferMemory(logicalDevice, buffer, bufferMemory.memory, bufferMemory.offset);
     Assert(result == VK_SUCCESS);
 }
 
-void diamond::CreateVertexBuffer(int vertexSize, int maxVertexCount, VkBuffer& vertexBuffer, VkDeviceMemory& vertexBufferMemory)
+diamond_allocation diamond::AllocateMemory(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties, bool optimalImage, bool transient)
 {
-    VkDeviceSize bufferSize = vertexSize * maxVertexCount;
-    CreateBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vertexBuffer, vertexBufferMemory);
-}
+    std::lock_guard<std::mutex> lock(allocatorMutex);
 
-void diamond::CreateIndexBuffer(int maxIndexCount, VkBuffer& indexBuffer, VkDeviceMemory& indexBufferMemory)
-{
-    VkDeviceSize bufferSize = sizeof(u16) * maxIndexCount;
-    CreateBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indexBuffer, indexBufferMemory);
-}
+    diamond_allocation allocation;
+    u32 memoryType = FindMemoryType(requirements.memoryTypeBits, properties);
+    bool hostVisible = memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
 
-void diamond::CreateGraphicsPipeline(diamond_graphics_pipeline& pipeline)
-{
-    VkShaderModule vertShader = CreateShaderModule(pipeline.pipelineInfo.vertexShaderPath);
-    VkShaderModule fragShader = CreateShaderModule(pipeline.pipelineInfo.fragmentShaderPath);
+    // every memory type and kind of resource gets its own pool
+    int poolIndex = -1;
+    for (int i = 0; i < memoryPools.size(); i++)
+    {
+        if (memoryPools[i].memoryType == memoryType && memoryPools[i].optimalImages == optimalImage && memoryPools[i].transient == transient)
+        {
+            poolIndex = i;
+            break;
+        }
+    }
+    if (poolIndex == -1)
+    {
+        diamond_memory_pool pool;
+        pool.memoryType = memoryType;
+        pool.optimalImages = optimalImage;
+        pool.transient = transient;
+
+        // keep blocks a power of two so that buddies divide them evenly, and small enough that a heap fits a few of them
+        VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+        pool.blockSize = MEMORY_BLOCK_SIZE;
+        while (pool.blockSize > MIN_ALLOCATION_SIZE && pool.blockSize > heapSize / 8)
+            pool.blockSize /= 2;
+
+        memoryPools.push_back(pool);
+        poolIndex = static_cast<int>(memoryPools.size() - 1);
+    }
+    diamond_memory_pool& pool = memoryPools[poolIndex];
+    allocation.poolIndex = poolIndex;
+    allocation.size = requirements.size;
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {
-        CreateShaderStage(vertShader, VK_SHADER_STAGE_VERTEX_BIT),
-        CreateShaderStage(fragShader, VK_SHADER_STAGE_FRAGMENT_BIT)
-    };
+    auto allocateDeviceMemory = [this, memoryType, hostVisible](VkDeviceSize size, VkDeviceMemory& memory, void*& mapped)
+    {
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryType;
 
-    auto bindingDescription = pipeline.pipelineInfo.getVertexBindingDescription();
-    auto attributeDescriptions = pipeline.pipelineInfo.getVertexAttributeDescriptions();
+        VkResult result = vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &memory);
+        Assert(result == VK_SUCCESS);
 
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<u32>(attributeDescriptions.size());
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+        // memory can only be mapped once at a time, so host visible memory stays mapped instead of every user mapping its own range
+        mapped = nullptr;
+        if (hostVisible)
+        {
+            result = vkMapMemory(logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+            Assert(result == VK_SUCCESS);
+        }
+    };
 
-    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = pipeline.pipelineInfo.vertexTopology;
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
+    // large resources would waste most of a block
+    if (requirements.size > pool.blockSize / 2)
+    {
+        allocateDeviceMemory(requirements.size, allocation.memory, allocation.mapped);
+        return allocation;
+    }
 
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float) swapChain.swapChainExtent.width;
-    viewport.height = (float) swapChain.swapChainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+    // long lived allocations are rounded up to a power of two buddy, whose offset is a multiple of its size and thereby of the alignment
+    u32 order = 0;
+    u32 topOrder = 0;
+    while ((MIN_ALLOCATION_SIZE << order) < std::max(requirements.size, requirements.alignment))
+        order++;
+    while ((MIN_ALLOCATION_SIZE << topOrder) < pool.blockSize)
+        topOrder++;
 
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = swapChain.swapChainExtent;
+    auto allocateFromBlock = [&](diamond_memory_block& block, VkDeviceSize& offset)
+    {
+        if (pool.transient)
+        {
+            VkDeviceSize alignedOffset = (block.linearOffset + requirements.alignment - 1) / requirements.alignment * requirements.alignment;
+            if (alignedOffset + requirements.size > block.size)
+                return false;
+            offset = alignedOffset;
+            block.linearOffset = alignedOffset + requirements.size;
+            return true;
+        }
 
-    VkPipelineViewportStateCreateInfo viewportState{};
-    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
-    viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+        u32 freeOrder = order;
+        while (freeOrder <= topOrder && block.freeOffsets[freeOrder].empty())
+            freeOrder++;
+        if (freeOrder > topOrder)
+            return false;
 
-    VkPipelineRasterizationStateCreateInfo rasterizer{};
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-    rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-    rasterizer.depthBiasClamp = 0.0f; // Optional
-    rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+        // split the buddy until it has the requested size, handing the upper halves back to the free lists
+        offset = *block.freeOffsets[freeOrder].begin();
+        block.freeOffsets[freeOrder].erase(block.freeOffsets[freeOrder].begin());
+        while (freeOrder > order)
+        {
+            freeOrder--;
+            block.freeOffsets[freeOrder].insert(offset + (MIN_ALLOCATION_SIZE << freeOrder));
+        }
+        return true;
+    };
 
-    VkPipelineMultisampleStateCreateInfo multisampling{};
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = msaaSamples;
-    multisampling.minSampleShading = 1.0f; // Optional
-    multisampling.pSampleMask = nullptr; // Optional
-    multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-    multisampling.alphaToOneEnable = VK_FALSE; // Optional
+    int blockIndex = -1;
+    VkDeviceSize offset = 0;
+    for (int i = 0; i < pool.blocks.size(); i++)
+    {
+        if (pool.blocks[i].memory != VK_NULL_HANDLE && allocateFromBlock(pool.blocks[i], offset))
+        {
+            blockIndex = i;
+            break;
+        }
+    }
+    if (blockIndex == -1)
+    {
+        diamond_memory_block block;
+        block.size = pool.blockSize;
+        allocateDeviceMemory(block.size, block.memory, block.mapped);
+        if (!pool.transient)
+        {
+            block.freeOffsets.resize(topOrder + 1);
+            block.freeOffsets[topOrder].insert(0);
+        }
 
-    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_TRUE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+        // reuse the slot of a released block so the indices of live allocations stay valid
+        for (int i = 0; i < pool.blocks.size(); i++)
+        {
+            if (pool.blocks[i].memory == VK_NULL_HANDLE)
+            {
+                blockIndex = i;
+                break;
+            }
+        }
+        if (blockIndex == -1)
+        {
+            pool.blocks.push_back(block);
+            blockIndex = static_cast<int>(pool.blocks.size() - 1);
+        }
+        else
+            pool.blocks[blockIndex] = block;
 
-    VkPipelineColorBlendStateCreateInfo colorBlending{};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-    colorBlending.blendConstants[0] = 0.0f; // Optional
-    colorBlending.blendConstants[1] = 0.0f; // Optional
-    colorBlending.blendConstants[2] = 0.0f; // Optional
-    colorBlending.blendConstants[3] = 0.0f; // Optional
+        bool allocated = allocateFromBlock(pool.blocks[blockIndex], offset);
+        Assert(allocated);
+    }
 
-    VkDynamicState dynamicStates[] = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR
-        //VK_DYNAMIC_STATE_LINE_WIDTH
-    };
-    VkPipelineDynamicStateCreateInfo dynamicState{};
-    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicState.dynamicStateCount = 2;
-    dynamicState.pDynamicStates = dynamicStates;
+    diamond_memory_block& block = pool.blocks[blockIndex];
+    block.liveAllocations++;
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.blockIndex = blockIndex;
+    allocation.order = order;
+    if (block.mapped)
+        allocation.mapped = static_cast<u8*>(block.mapped) + offset;
 
-    VkPushConstantRange pushConstants{};
-    pushConstants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    pushConstants.offset = 0;
-    pushConstants.size = sizeof(diamond_object_data);
+    return allocation;
+}
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = 1;
-    pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
-    VkResult result = vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipeline.pipelineLayout);
+void diamond::FreeMemory(diamond_allocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    std::lock_guard<std::mutex> lock(allocatorMutex);
+
+    if (allocation.blockIndex == -1)
+        vkFreeMemory(logicalDevice, allocation.memory, nullptr);
+    else
+    {
+        diamond_memory_pool& pool = memoryPools[allocation.poolIndex];
+        diamond_memory_block& block = pool.blocks[allocation.blockIndex];
+        block.liveAllocations--;
+
+        if (pool.transient)
+        {
+            // the linear region can only be reused once nothing in it is alive anymore
+            if (block.liveAllocations == 0)
+                block.linearOffset = 0;
+        }
+        else
+        {
+            // merge with the buddy for as long as it is free as well
+            u32 order = allocation.order;
+            VkDeviceSize offset = allocation.offset;
+            while (order + 1 < block.freeOffsets.size())
+            {
+                auto buddy = block.freeOffsets[order].find(offset ^ (MIN_ALLOCATION_SIZE << order));
+                if (buddy == block.freeOffsets[order].end())
+                    break;
+                block.freeOffsets[order].erase(buddy);
+                offset &= ~(MIN_ALLOCATION_SIZE << order);
+                order++;
+            }
+            block.freeOffsets[order].insert(offset);
+        }
+
+        // release empty blocks as long as the pool keeps another one around
+        if (block.liveAllocations == 0)
+        {
+            int otherBlocks = 0;
+            for (int i = 0; i < pool.blocks.size(); i++)
+            {
+                if (i != allocation.blockIndex && pool.blocks[i].memory != VK_NULL_HANDLE)
+                    otherBlocks++;
+            }
+            if (otherBlocks > 0)
+            {
+                vkFreeMemory(logicalDevice, block.memory, nullptr);
+                block = diamond_memory_block();
+            }
+        }
+    }
+
+    allocation = diamond_allocation();
+}
+
+void diamond::CreateUploadResources()
+{
+    CreateStreamBuffer(UPLOAD_STAGING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, uploadStaging);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = queueFamilies.transferFamily.value();
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    VkResult result = vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &transferCommandPool);
     Assert(result == VK_SUCCESS);
 
-    VkPipelineDepthStencilStateCreateInfo depthStencil{};
-    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencil.depthTestEnable = pipeline.pipelineInfo.enableDepthTesting;
-    depthStencil.depthWriteEnable = pipeline.pipelineInfo.enableDepthTesting;
-    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-    depthStencil.depthBoundsTestEnable = VK_FALSE;
-    depthStencil.minDepthBounds = 0.0f; // Optional
-    depthStencil.maxDepthBounds = 1.0f; // Optional
-    depthStencil.stencilTestEnable = VK_FALSE;
-    depthStencil.front = {}; // Optional
-    depthStencil.back = {}; // Optional
+    // every batch signals the next value when it completes, in submission order
+    VkSemaphoreTypeCreateInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
 
-    VkGraphicsPipelineCreateInfo pipelineInfo{};
-    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = &depthStencil; // Optional
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = &dynamicState; // Optional
-    pipelineInfo.layout = pipeline.pipelineLayout;
-    pipelineInfo.renderPass = renderPass;
-    pipelineInfo.subpass = 0;
-    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-    pipelineInfo.basePipelineIndex = -1; // Optional
-    result = vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline.pipeline);
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &timelineInfo;
+
+    result = vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &uploadTimeline);
     Assert(result == VK_SUCCESS);
+    uploadTimelineValue = 0;
+    uploadWaitValue = 0;
 
-    vkDestroyShaderModule(logicalDevice, vertShader, nullptr);
-    vkDestroyShaderModule(logicalDevice, fragShader, nullptr);
+    uploadBatches.resize(UPLOAD_BATCH_COUNT);
+    for (int i = 0; i < UPLOAD_BATCH_COUNT; i++)
+    {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = transferCommandPool;
+        allocInfo.commandBufferCount = 1;
+
+        result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &uploadBatches[i].commandBuffer);
+        Assert(result == VK_SUCCESS);
+    }
+    currentUploadBatch = 0;
 }
 
-void diamond::CreateComputePipeline(diamond_compute_pipeline& pipeline)
+void diamond::CleanupUploadResources()
 {
-    VkShaderModule computeModule = CreateShaderModule(pipeline.pipelineInfo.computeShaderPath);
+    // a batch which is still recording was never submitted, so its uploads are simply dropped
+    WaitForUploads();
+    for (int i = 0; i < uploadBatches.size(); i++)
+    {
+        uploadBatches[i].recording = false;
+        RetireUploadBatch(uploadBatches[i]);
+    }
+    uploadBatches.clear();
+    pendingAcquires.clear();
+    vkDestroyCommandPool(logicalDevice, transferCommandPool, nullptr);
+    vkDestroySemaphore(logicalDevice, uploadTimeline, nullptr);
+    CleanupStreamBuffer(uploadStaging);
+}
 
-    VkPushConstantRange pushConstants{};
-    pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-    pushConstants.offset = 0;
-    pushConstants.size = pipeline.pipelineInfo.pushConstantsDataSize;
+VkCommandBuffer diamond::GetUploadCommandBuffer()
+{
+    diamond_upload_batch& batch = uploadBatches[currentUploadBatch];
+    if (!batch.recording)
+    {
+        // the batches after the current one are newer, so this one is the oldest still in flight
+        if (batch.submitted)
+            RetireUploadBatch(batch);
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &pipeline.descriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = pipeline.pipelineInfo.usePushConstants;
-    pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
-    VkResult result = vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipeline.pipelineLayout);
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        VkResult result = vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+        Assert(result == VK_SUCCESS);
+        batch.recording = true;
+        batch.timelineValue = ++uploadTimelineValue;
+    }
+    return batch.commandBuffer;
+}
+
+VkDeviceSize diamond::StageUploadData(const void* data, VkDeviceSize size, VkBuffer& stagingBuffer)
+{
+    // covers the texel size of every format so the offset is valid for image copies as well
+    VkDeviceSize alignment = std::max(static_cast<VkDeviceSize>(16), physicalDeviceProperties.limits.optimalBufferCopyOffsetAlignment);
+
+    // too large for the ring, so it gets its own buffer which lives until the batch completes
+    if (size + alignment > uploadStaging.size)
+    {
+        VkBuffer buffer;
+        diamond_allocation bufferMemory;
+        CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory, false, true);
+        memcpy(bufferMemory.mapped, data, static_cast<size_t>(size));
+
+        GetUploadCommandBuffer();
+        uploadBatches[currentUploadBatch].oversizedBuffers.push_back(buffer);
+        uploadBatches[currentUploadBatch].oversizedBuffersMemory.push_back(bufferMemory);
+        stagingBuffer = buffer;
+        return 0;
+    }
+
+    // same rules as the stream buffers, except that running out of space waits for the oldest batch instead of failing
+    VkDeviceSize offset = 0;
+    auto fits = [this, size, alignment, &offset]()
+    {
+        if (uploadStaging.head == uploadStaging.tail) // nothing is pending, so start over at the beginning
+        {
+            uploadStaging.head = 0;
+            uploadStaging.tail = 0;
+        }
+
+        offset = ((uploadStaging.head + alignment - 1) / alignment) * alignment;
+        if (uploadStaging.head >= uploadStaging.tail)
+        {
+            if (offset + size <= uploadStaging.size)
+                return true;
+            offset = 0;
+            return size < uploadStaging.tail;
+        }
+        return offset + size < uploadStaging.tail;
+    };
+    while (!fits())
+    {
+        int oldestBatch = -1;
+        for (int i = 0; i < uploadBatches.size(); i++)
+        {
+            int batchIndex = (currentUploadBatch + i) % UPLOAD_BATCH_COUNT;
+            if (uploadBatches[batchIndex].submitted)
+            {
+                oldestBatch = batchIndex;
+                break;
+            }
+        }
+
+        // only the batch being recorded holds on to staging memory otherwise
+        if (oldestBatch == -1)
+            SubmitUploads();
+        else
+            RetireUploadBatch(uploadBatches[oldestBatch]);
+    }
+
+    memcpy(static_cast<u8*>(uploadStaging.mapped) + offset, data, static_cast<size_t>(size));
+    uploadStaging.head = offset + size;
+    stagingBuffer = uploadStaging.buffer;
+    return offset;
+}
+
+void diamond::UploadBufferData(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+    VkBuffer stagingBuffer;
+    VkDeviceSize stagingOffset = StageUploadData(data, size, stagingBuffer);
+    VkCommandBuffer commandBuffer = GetUploadCommandBuffer();
+
+    VkBufferCopy copy{};
+    copy.srcOffset = stagingOffset;
+    copy.dstOffset = dstOffset;
+    copy.size = size;
+    vkCmdCopyBuffer(commandBuffer, stagingBuffer, dstBuffer, 1, &copy);
+
+    ReleaseUploadedBuffer(commandBuffer, dstBuffer, dstOffset, size);
+}
+
+void diamond::SubmitUploads()
+{
+    diamond_upload_batch& batch = uploadBatches[currentUploadBatch];
+    if (!batch.recording)
+        return;
+
+    VkResult result = vkEndCommandBuffer(batch.commandBuffer);
     Assert(result == VK_SUCCESS);
 
-    VkComputePipelineCreateInfo info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
-    info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    info.stage.module = computeModule;
-    info.stage.pName = pipeline.pipelineInfo.entryFunctionName;
-    info.layout = pipeline.pipelineLayout;
-    result = vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline.pipeline);
+    // without a dedicated transfer family this is the graphics queue, where later submissions are ordered after the barriers in
+    // the batch. Otherwise the frames which acquire the uploaded resources wait on the timeline
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &batch.timelineValue;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &uploadTimeline;
+
+    result = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
     Assert(result == VK_SUCCESS);
 
-    vkDestroyShaderModule(logicalDevice, computeModule, nullptr);
+    batch.recording = false;
+    batch.submitted = true;
+    batch.stagingEnd = uploadStaging.head;
+    currentUploadBatch = (currentUploadBatch + 1) % UPLOAD_BATCH_COUNT;
+}
+
+void diamond::RetireUploadBatch(diamond_upload_batch& batch)
+{
+    if (batch.submitted)
+    {
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &uploadTimeline;
+        waitInfo.pValues = &batch.timelineValue;
+        vkWaitSemaphores(logicalDevice, &waitInfo, UINT64_MAX);
+        uploadStaging.tail = batch.stagingEnd;
+        batch.submitted = false;
+    }
+
+    for (int i = 0; i < batch.oversizedBuffers.size(); i++)
+    {
+        vkDestroyBuffer(logicalDevice, batch.oversizedBuffers[i], nullptr);
+        FreeMemory(batch.oversizedBuffersMemory[i]);
+    }
+    batch.oversizedBuffers.clear();
+    batch.oversizedBuffersMemory.clear();
+}
+
+void diamond::WaitForUploads()
+{
+    // oldest first so that the staging tail only ever moves forward
+    for (int i = 0; i < uploadBatches.size(); i++)
+    {
+        diamond_upload_batch& batch = uploadBatches[(currentUploadBatch + i) % UPLOAD_BATCH_COUNT];
+        if (batch.submitted)
+            RetireUploadBatch(batch);
+    }
+}
+
+void diamond::ReleaseUploadedImage(VkCommandBuffer commandBuffer, VkImage image)
+{
+    u32 transferFamily = queueFamilies.transferFamily.value();
+    u32 graphicsFamily = queueFamilies.graphicsFamily.value();
+    if (transferFamily == graphicsFamily)
+    {
+        TransitionImageLayout(commandBuffer, image, VK_FORMAT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        return;
+    }
+
+    // the layout transition is part of the ownership transfer and has to match the acquire exactly
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    diamond_upload_acquire acquire{};
+    acquire.image = image;
+    acquire.uploadHandle = uploadBatches[currentUploadBatch].timelineValue;
+    pendingAcquires.push_back(acquire);
+}
+
+void diamond::ReleaseUploadedBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    // the consumer is not known here, so make the data visible to every later command on the queue
+    u32 transferFamily = queueFamilies.transferFamily.value();
+    u32 graphicsFamily = queueFamilies.graphicsFamily.value();
+    if (transferFamily == graphicsFamily)
+    {
+        MemoryBarrier(commandBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+        return;
+    }
+
+    // uploads only ever target buffers which have not been used yet, otherwise the graphics family would have to release them first
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    diamond_upload_acquire acquire{};
+    acquire.buffer = buffer;
+    acquire.offset = offset;
+    acquire.size = size;
+    acquire.uploadHandle = uploadBatches[currentUploadBatch].timelineValue;
+    pendingAcquires.push_back(acquire);
+}
+
+void diamond::AcquireUploads(VkCommandBuffer commandBuffer)
+{
+    // only called after SubmitUploads(), so every release has been submitted
+    if (pendingAcquires.empty())
+        return;
+
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    for (const diamond_upload_acquire& acquire : pendingAcquires)
+    {
+        if (acquire.image != VK_NULL_HANDLE)
+        {
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcQueueFamilyIndex = queueFamilies.transferFamily.value();
+            barrier.dstQueueFamilyIndex = queueFamilies.graphicsFamily.value();
+            barrier.image = acquire.image;
+            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            barrier.subresourceRange.baseMipLevel = 0;
+            barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount = 1;
+            imageBarriers.push_back(barrier);
+        }
+        else
+        {
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+            barrier.srcQueueFamilyIndex = queueFamilies.transferFamily.value();
+            barrier.dstQueueFamilyIndex = queueFamilies.graphicsFamily.value();
+            barrier.buffer = acquire.buffer;
+            barrier.offset = acquire.offset;
+            barrier.size = acquire.size;
+            bufferBarriers.push_back(barrier);
+        }
+        uploadWaitValue = std::max(uploadWaitValue, acquire.uploadHandle);
+    }
+    pendingAcquires.clear();
+
+    // the source stages match the ones the submission waits on the upload timeline with, which chains the acquire after the release
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        stages, stages,
+        0,
+        0, nullptr,
+        static_cast<u32>(bufferBarriers.size()), bufferBarriers.data(),
+        static_cast<u32>(imageBarriers.size()), imageBarriers.data()
+    );
+}
+
+diamond_deferred_deletion& diamond::DeferredDeletion()
+{
+    // the frame being recorded is submitted with the next value. Objects released between frames wait for one extra frame
+    u64 graphicsValue = graphicsTimelineValue + 1;
+    if (deferredDeletions.empty() || deferredDeletions.back().graphicsValue != graphicsValue)
+    {
+        diamond_deferred_deletion deletion{};
+        deletion.graphicsValue = graphicsValue;
+        deferredDeletions.push_back(deletion);
+    }
+    return deferredDeletions.back();
+}
+
+void diamond::CleanupStaticMesh(diamond_static_mesh& mesh)
+{
+    if (mesh.enabled)
+    {
+        diamond_deferred_deletion& deletion = DeferredDeletion();
+        deletion.buffers.push_back(mesh.buffer);
+        deletion.allocations.push_back(mesh.memory);
+        mesh.buffer = VK_NULL_HANDLE;
+        mesh.memory = {};
+        mesh.enabled = false;
+    }
+}
+
+void diamond::RecordStaticMeshDraw(diamond_recording_context& context, const diamond_static_mesh& mesh)
+{
+    VkCommandBuffer commandBuffer = context.commandBuffers[currentFrameIndex];
+    VkDeviceSize offsets[] = { 0 };
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &mesh.buffer, offsets);
+    if (mesh.indexCount > 0)
+    {
+        vkCmdBindIndexBuffer(commandBuffer, mesh.buffer, mesh.indexOffset, mesh.indexType);
+        vkCmdDrawIndexed(commandBuffer, mesh.indexCount, 1, 0, 0, 0);
+    }
+    else
+        vkCmdDraw(commandBuffer, mesh.vertexCount, 1, 0, 0);
+
+    // later draws of the frame go back to the streamed geometry of the pipeline
+    const diamond_recording_geometry& geometry = context.geometry[context.boundGraphicsPipelineIndex];
+    if (geometry.vertexBuffer != VK_NULL_HANDLE)
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &geometry.vertexBuffer, offsets);
+    if (mesh.indexCount > 0 && geometry.indexBuffer != VK_NULL_HANDLE)
+        vkCmdBindIndexBuffer(commandBuffer, geometry.indexBuffer, 0, graphicsPipelines[context.boundGraphicsPipelineIndex].pipelineInfo.indexType);
+}
+
+void diamond::RetireDeletions(bool all)
+{
+    // graphics submissions wait on the compute work of their frame, so the graphics timeline covers both queues
+    uint64_t completedValue = 0;
+    uint64_t completedUploadValue = 0;
+    if (!all)
+    {
+        VkResult result = vkGetSemaphoreCounterValue(logicalDevice, graphicsTimeline, &completedValue);
+        Assert(result == VK_SUCCESS);
+        result = vkGetSemaphoreCounterValue(logicalDevice, uploadTimeline, &completedUploadValue);
+        Assert(result == VK_SUCCESS);
+    }
+
+    int retired = 0;
+    for (; retired < deferredDeletions.size(); retired++)
+    {
+        diamond_deferred_deletion& deletion = deferredDeletions[retired];
+        if (!all && (deletion.graphicsValue > completedValue || deletion.uploadValue > completedUploadValue))
+            break;
+
+        for (VkPipeline pipeline : deletion.pipelines)
+            vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+        for (VkPipelineLayout layout : deletion.pipelineLayouts)
+            vkDestroyPipelineLayout(logicalDevice, layout, nullptr);
+        for (VkCommandPool pool : deletion.commandPools)
+            vkDestroyCommandPool(logicalDevice, pool, nullptr);
+        for (VkDescriptorPool pool : deletion.descriptorPools)
+            vkDestroyDescriptorPool(logicalDevice, pool, nullptr);
+        for (VkDescriptorSetLayout layout : deletion.descriptorSetLayouts)
+            vkDestroyDescriptorSetLayout(logicalDevice, layout, nullptr);
+        for (VkImageView view : deletion.imageViews)
+            vkDestroyImageView(logicalDevice, view, nullptr);
+        for (VkImage image : deletion.images)
+            vkDestroyImage(logicalDevice, image, nullptr);
+        for (VkBuffer buffer : deletion.buffers)
+            vkDestroyBuffer(logicalDevice, buffer, nullptr);
+        for (diamond_allocation& allocation : deletion.allocations)
+            FreeMemory(allocation);
+    }
+    deferredDeletions.erase(deferredDeletions.begin(), deferredDeletions.begin() + retired);
+}
+
+void diamond::CleanupMemoryPools()
+{
+    for (int i = 0; i < memoryPools.size(); i++)
+    {
+        for (int j = 0; j < memoryPools[i].blocks.size(); j++)
+        {
+            if (memoryPools[i].blocks[j].memory != VK_NULL_HANDLE)
+                vkFreeMemory(logicalDevice, memoryPools[i].blocks[j].memory, nullptr);
+        }
+    }
+    memoryPools.clear();
+}
+
+void diamond::CreateStreamBuffer(VkDeviceSize size, VkBufferUsageFlags usage, diamond_stream_buffer& stream)
+{
+    CreateBuffer(size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stream.buffer, stream.memory);
+    stream.mapped = stream.memory.mapped;
+    stream.size = size;
+    stream.usage = usage;
+    stream.head = 0;
+    stream.tail = 0;
+    stream.frameStarts.assign(MAX_FRAMES_IN_FLIGHT, 0);
+}
+
+void diamond::CleanupStreamBuffer(diamond_stream_buffer& stream)
+{
+    diamond_deferred_deletion& deletion = DeferredDeletion();
+    deletion.buffers.push_back(stream.buffer);
+    deletion.allocations.push_back(stream.memory);
+    deletion.buffers.insert(deletion.buffers.end(), stream.retiredBuffers.begin(), stream.retiredBuffers.end());
+    deletion.allocations.insert(deletion.allocations.end(), stream.retiredMemory.begin(), stream.retiredMemory.end());
+    stream.retiredBuffers.clear();
+    stream.retiredMemory.clear();
+    stream.memory = {};
+    stream.buffer = VK_NULL_HANDLE;
+    stream.mapped = nullptr;
+}
+
+void diamond::BeginStreamFrame(diamond_stream_buffer& stream)
+{
+    // must only be called once the fence of the current frame has been waited on. Everything written by this frame slot
+    // last time around is free now, so the oldest frame still in flight (the next slot) determines where the used region begins
+    stream.tail = stream.frameStarts[(currentFrameIndex + 1) % MAX_FRAMES_IN_FLIGHT];
+    stream.frameStarts[currentFrameIndex] = stream.head;
+
+    stream.lastFrameUsed = stream.frameUsed;
+    stream.peakFrameUsed = std::max(stream.peakFrameUsed, stream.frameUsed);
+    stream.frameUsed = 0;
+
+    // buffers which were outgrown are released once the frames that were recorded with them complete
+    if (!stream.retiredBuffers.empty())
+    {
+        diamond_deferred_deletion& deletion = DeferredDeletion();
+        deletion.buffers.insert(deletion.buffers.end(), stream.retiredBuffers.begin(), stream.retiredBuffers.end());
+        deletion.allocations.insert(deletion.allocations.end(), stream.retiredMemory.begin(), stream.retiredMemory.end());
+        stream.retiredBuffers.clear();
+        stream.retiredMemory.clear();
+    }
+}
+
+void diamond::GrowStreamBuffer(diamond_stream_buffer& stream, VkDeviceSize size, VkDeviceSize alignment)
+{
+    // frames in flight and earlier draws of this frame keep reading the old buffer, so the new one starts out empty. It is
+    // also called from recording threads, which is why destroying the old buffer is left to BeginStreamFrame()
+    stream.retiredBuffers.push_back(stream.buffer);
+    stream.retiredMemory.push_back(stream.memory);
+
+    VkDeviceSize newSize = std::max(stream.size * 2, alignment);
+    while (newSize < size + alignment)
+        newSize *= 2;
+    CreateStreamBuffer(newSize, stream.usage, stream);
+}
+
+VkDeviceSize diamond::AllocateContextStreamMemory(diamond_recording_context& context, diamond_stream_buffer& stream, diamond_stream_chunk& chunk, VkDeviceSize size, VkDeviceSize alignment)
+{
+    // the main context allocates exactly what it needs, while the other contexts claim larger chunks so they only rarely have to lock
+    if (&context == &mainContext)
+    {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        VkDeviceSize offset = AllocateStreamMemory(stream, size, alignment);
+        chunk.buffer = stream.buffer;
+        chunk.mapped = static_cast<u8*>(stream.mapped);
+        return offset;
+    }
+
+    VkDeviceSize offset = ((chunk.offset + chunk.used + alignment - 1) / alignment) * alignment;
+    if (chunk.size == 0 || offset + size > chunk.offset + chunk.size)
+    {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        chunk.size = std::max(size, stream.size / (MAX_FRAMES_IN_FLIGHT * STREAM_CHUNKS_PER_FRAME));
+        chunk.offset = AllocateStreamMemory(stream, chunk.size, alignment);
+        chunk.buffer = stream.buffer;
+        chunk.mapped = static_cast<u8*>(stream.mapped);
+        offset = chunk.offset;
+    }
+    chunk.used = offset + size - chunk.offset;
+
+    return offset;
+}
+
+VkDeviceSize diamond::AllocateStreamMemory(diamond_stream_buffer& stream, VkDeviceSize size, VkDeviceSize alignment)
+{
+    // allocations never catch up to the tail, so head == tail always means that nothing is in flight
+    VkDeviceSize offset = ((stream.head + alignment - 1) / alignment) * alignment;
+    bool fits = true;
+    if (stream.head >= stream.tail)
+    {
+        if (offset + size > stream.size) // wrap around to the start of the buffer
+        {
+            offset = 0;
+            fits = size < stream.tail;
+        }
+    }
+    else
+        fits = offset + size < stream.tail;
+
+    // more data was bound than the frames in flight leave room for
+    if (!fits)
+    {
+        GrowStreamBuffer(stream, size, alignment);
+        offset = 0;
+    }
+
+    stream.head = offset + size;
+    stream.frameUsed += size;
+    return offset;
+}
+
+void diamond::CreateGraphicsPipeline(diamond_graphics_pipeline& pipeline)
+{
+    VkShaderModule vertShader = CreateShaderModule(pipeline.pipelineInfo.vertexShaderPath);
+    VkShaderModule fragShader = CreateShaderModule(pipeline.pipelineInfo.fragmentShaderPath);
+
+    VkPipelineShaderStageCreateInfo shaderStages[] = {
+        CreateShaderStage(vertShader, VK_SHADER_STAGE_VERTEX_BIT),
+        CreateShaderStage(fragShader, VK_SHADER_STAGE_FRAGMENT_BIT)
+    };
+
+    auto bindingDescription = pipeline.pipelineInfo.getVertexBindingDescription();
+    auto attributeDescriptions = pipeline.pipelineInfo.getVertexAttributeDescriptions();
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<u32>(attributeDescriptions.size());
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = pipeline.pipelineInfo.vertexTopology;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float) swapChain.swapChainExtent.width;
+    viewport.height = (float) swapChain.swapChainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = swapChain.swapChainExtent;
+
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.pViewports = &viewport;
+    viewportState.scissorCount = 1;
+    viewportState.pScissors = &scissor;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_FALSE;
+    rasterizer.depthBiasConstantFactor = 0.0f; // Optional
+    rasterizer.depthBiasClamp = 0.0f; // Optional
+    rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = msaaSamples;
+    multisampling.minSampleShading = 1.0f; // Optional
+    multisampling.pSampleMask = nullptr; // Optional
+    multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
+    multisampling.alphaToOneEnable = VK_FALSE; // Optional
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = VK_TRUE;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+    colorBlending.blendConstants[0] = 0.0f; // Optional
+    colorBlending.blendConstants[1] = 0.0f; // Optional
+    colorBlending.blendConstants[2] = 0.0f; // Optional
+    colorBlending.blendConstants[3] = 0.0f; // Optional
+
+    VkDynamicState dynamicStates[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+        //VK_DYNAMIC_STATE_LINE_WIDTH
+    };
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    VkPushConstantRange pushConstants{};
+    pushConstants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstants.offset = 0;
+    pushConstants.size = sizeof(diamond_object_data);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+    VkResult result = vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipeline.pipelineLayout);
+    Assert(result == VK_SUCCESS);
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = pipeline.pipelineInfo.enableDepthTesting;
+    depthStencil.depthWriteEnable = pipeline.pipelineInfo.enableDepthTesting;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.minDepthBounds = 0.0f; // Optional
+    depthStencil.maxDepthBounds = 1.0f; // Optional
+    depthStencil.stencilTestEnable = VK_FALSE;
+    depthStencil.front = {}; // Optional
+    depthStencil.back = {}; // Optional
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil; // Optional
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState; // Optional
+    pipelineInfo.layout = pipeline.pipelineLayout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 0;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
+    pipelineInfo.basePipelineIndex = -1; // Optional
+    result = vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline.pipeline);
+    Assert(result == VK_SUCCESS);
+
+    vkDestroyShaderModule(logicalDevice, vertShader, nullptr);
+    vkDestroyShaderModule(logicalDevice, fragShader, nullptr);
+}
+
+void diamond::CreateComputePipeline(diamond_compute_pipeline& pipeline)
+{
+    VkShaderModule computeModule = CreateShaderModule(pipeline.pipelineInfo.computeShaderPath);
+
+    VkPushConstantRange pushConstants{};
+    pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstants.offset = 0;
+    pushConstants.size = pipeline.pipelineInfo.pushConstantsDataSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = pipeline.pipelineInfo.usePushConstants;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+    VkResult result = vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipeline.pipelineLayout);
+    Assert(result == VK_SUCCESS);
+
+    VkComputePipelineCreateInfo info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    info.stage.module = computeModule;
+    info.stage.pName = pipeline.pipelineInfo.entryFunctionName;
+    info.layout = pipeline.pipelineLayout;
+    result = vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline.pipeline);
+    Assert(result == VK_SUCCESS);
+
+    vkDestroyShaderModule(logicalDevice, computeModule, nullptr);
+}
+
+void diamond::CreateDescriptorSetLayout()
+{
+    VkDescriptorSetLayoutBinding uboLayoutBinding{};
+    uboLayoutBinding.binding = 0;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorCount = 1;
+    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    uboLayoutBinding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutBinding samplerLayoutBinding{};
+    samplerLayoutBinding.binding = 1;
+    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    samplerLayoutBinding.descriptorCount = textureCapacity;
+    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    samplerLayoutBinding.pImmutableSamplers = nullptr;
+
+    // the texture table is written while frames which use it are being recorded, and only the registered part of it is valid
+    std::array<VkDescriptorBindingFlags, 2> bindingFlags = {
+        0,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = static_cast<u32>(bindingFlags.size());
+    bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = static_cast<u32>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    VkResult result = vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &descriptorSetLayout);
+    Assert(result == VK_SUCCESS);
+}
+
+void diamond::CreateComputeDescriptorSetLayout(diamond_compute_pipeline& pipeline, int bufferCount, int imageCount)
+{
+    std::vector<VkDescriptorSetLayoutBinding> bindings(bufferCount + imageCount);
+    for (int i = 0; i < bufferCount; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[i].pImmutableSamplers = nullptr;
+    }
+    for (int i = bufferCount; i < bufferCount + imageCount; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[i].pImmutableSamplers = nullptr;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<u32>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    VkResult result = vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &pipeline.descriptorSetLayout);
+    Assert(result == VK_SUCCESS);
+}
+
+void diamond::CreateRenderPass()
+{
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = VK_FORMAT_D32_SFLOAT;
+    depthAttachment.samples = msaaSamples;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription colorAttachment{};
+    colorAttachment.format = swapChain.swapChainImageFormat;
+    colorAttachment.samples = msaaSamples;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription colorAttachmentResolve{};
+    colorAttachmentResolve.format = swapChain.swapChainImageFormat;
+    colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachmentResolve.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    VkAttachmentReference colorAttachmentRef{};
+    colorAttachmentRef.attachment = 0;
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorAttachmentResolveRef{};
+    colorAttachmentResolveRef.attachment = 1;
+    colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef{};
+    depthAttachmentRef.attachment = 2;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pResolveAttachments = &colorAttachmentResolveRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    VkSubpassDependency dependency{};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    std::array<VkAttachmentDescription, 3> attachments = { colorAttachment, colorAttachmentResolve, depthAttachment };
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = static_cast<u32>(attachments.size());
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = &dependency;
+
+    VkResult result = vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, &renderPass);
+    Assert(result == VK_SUCCESS);
+}
+
+void diamond::CreateUniformBuffers()
+{
+    VkDeviceSize bufferSize = sizeof(diamond_frame_buffer_object);
+    
+    uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+    }
+}
+
+VkPipelineShaderStageCreateInfo diamond::CreateShaderStage(VkShaderModule shaderModule, VkShaderStageFlagBits stage, const char* entrypoint)
+{
+    VkPipelineShaderStageCreateInfo shaderStageInfo{};
+    shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStageInfo.stage = stage;
+    shaderStageInfo.module = shaderModule;
+    shaderStageInfo.pName = entrypoint;
+    shaderStageInfo.pSpecializationInfo = nullptr;
+
+    return shaderStageInfo;
+}
+
+VkShaderModule diamond::CreateShaderModule(const char* ShaderPath)
+{
+    std::ifstream file(ShaderPath, std::ios::ate | std::ios::binary);
+    Assert(file.is_open())
+    
+    u64 fileSize = file.tellg();
+    std::vector<char> buffer(fileSize);
+    file.seekg(0);
+    file.read(buffer.data(), fileSize);
+    file.close();
+
+    VkShaderModuleCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = buffer.size();
+    createInfo.pCode = reinterpret_cast<const u32*>(buffer.data());
+
+    VkShaderModule module;
+    VkResult result = vkCreateShaderModule(logicalDevice, &createInfo, nullptr, &module);
+    Assert(result == VK_SUCCESS);
+
+    return module;
+}
+
+bool diamond::CheckDeviceExtensionSupport(VkPhysicalDevice device)
+{
+    // get hardware extension support
+    u32 supportedExtensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &supportedExtensionCount, nullptr);
+    std::vector<VkExtensionProperties> supportedExtensions(supportedExtensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &supportedExtensionCount, supportedExtensions.data());
+
+    // check for compatability
+    int count = 0;
+    for (int i = 0; i < deviceExtensions.size(); i++)
+    {
+        if (std::find_if(supportedExtensions.begin(), supportedExtensions.end(), [this, &i](const VkExtensionProperties& arg) { return strcmp(arg.extensionName, deviceExtensions[i]); }) == supportedExtensions.end())
+            return false;
+    }
+
+    return true;
+}
+
+VkSampleCountFlagBits diamond::GetMaxSampleCount()
+{
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+    VkSampleCountFlags counts = physicalDeviceProperties.limits.framebufferColorSampleCounts & physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+
+    if (counts & VK_SAMPLE_COUNT_64_BIT) { return VK_SAMPLE_COUNT_64_BIT; }
+    if (counts & VK_SAMPLE_COUNT_32_BIT) { return VK_SAMPLE_COUNT_32_BIT; }
+    if (counts & VK_SAMPLE_COUNT_16_BIT) { return VK_SAMPLE_COUNT_16_BIT; }
+    if (counts & VK_SAMPLE_COUNT_8_BIT) { return VK_SAMPLE_COUNT_8_BIT; }
+    if (counts & VK_SAMPLE_COUNT_4_BIT) { return VK_SAMPLE_COUNT_4_BIT; }
+    if (counts & VK_SAMPLE_COUNT_2_BIT) { return VK_SAMPLE_COUNT_2_BIT; }
+
+    return VK_SAMPLE_COUNT_1_BIT;
+}
+
+bool diamond::IsDeviceSuitable(VkPhysicalDevice device)
+{
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(device, &deviceProperties);
+    VkPhysicalDeviceFeatures deviceFeatures;
+    vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+    diamond_queue_family_indices indices = GetQueueFamilies(device);
+
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timelineFeatures.pNext = nullptr;
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType	= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    indexingFeatures.pNext = &timelineFeatures;
+    VkPhysicalDeviceFeatures2 deviceFeatures2{};
+    deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures2.pNext = &indexingFeatures;
+    vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+
+    bool extensionsSupported = CheckDeviceExtensionSupport(device);
+    bool swapChainAdequate = headless;
+    if (extensionsSupported && !headless)
+    {
+        diamond_swap_chain_support_details swapDetails = GetSwapChainSupport(device);
+        swapChainAdequate = !swapDetails.formats.empty() && !swapDetails.presentModes.empty();
+    }
+
+    return (
+        indices.IsComplete() &&
+        deviceProperties.apiVersion >= VK_API_VERSION_1_2 &&
+        extensionsSupported &&
+        swapChainAdequate &&
+        deviceFeatures.samplerAnisotropy &&
+        deviceFeatures.shaderSampledImageArrayDynamicIndexing &&
+        indexingFeatures.descriptorBindingPartiallyBound &&
+        indexingFeatures.runtimeDescriptorArray &&
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+        indexingFeatures.descriptorBindingVariableDescriptorCount &&
+        timelineFeatures.timelineSemaphore
+    );
+}
+
+VkSurfaceFormatKHR diamond::ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats)
+{
+    for (const auto& availableFormat : formats)
+    {
+        if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+            return availableFormat;
+    }
+
+    return formats[0];
+}
+
+VkPresentModeKHR diamond::ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& presentModes)
+{
+    for (const auto& availablePresentMode : presentModes)
+    {
+        if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+            return availablePresentMode;
+    }
+
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+VkExtent2D diamond::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+{
+    if (capabilities.currentExtent.width != UINT32_MAX)
+        return capabilities.currentExtent;
+    else
+    {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        VkExtent2D actualExtent = {
+            static_cast<u32>(width),
+            static_cast<u32>(height)
+        };
+
+        actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
+        actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+
+        return actualExtent;
+    }
+}
+
+void diamond::MapMemory(void* data, u32 dataSize, u32 elementCount, const diamond_allocation& bufferMemory, u32 elementMemoryOffset)
+{
+    // only ever called on host visible memory, which the allocator keeps mapped
+    memcpy(static_cast<u8*>(bufferMemory.mapped) + elementMemoryOffset * dataSize, data, dataSize * elementCount);
+}
+
+void diamond::SetCameraViewMatrix(glm::mat4 matrix)
+{
+    cameraViewMatrix = matrix;
+}
+
+void diamond::UpdateCameraViewMode(diamond_camera_mode camMode, glm::vec2 camDimensions)
+{
+    cameraMode = camMode;
+    cameraDimensions = camDimensions;
+}
+
+void diamond::BeginFrame()
+{
+    DIAMOND_PROFILE_FUNCTION();
+
+    frameStartTime = std::chrono::high_resolution_clock::now();
+
+    if (!headless)
+        glfwPollEvents();
+
+    // wait until the gpu is done with this frame's resources before they get reused
+    vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrameIndex], VK_TRUE, UINT64_MAX);
+    VkSemaphoreWaitInfo computeWaitInfo{};
+    computeWaitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    computeWaitInfo.semaphoreCount = 1;
+    computeWaitInfo.pSemaphores = &computeTimeline;
+    computeWaitInfo.pValues = &computeFrameValues[currentFrameIndex];
+    vkWaitSemaphores(logicalDevice, &computeWaitInfo, UINT64_MAX);
+    ProcessTextureLoads();
+    UpdateTextureResidency();
+    FlushTextureDescriptorWrites(currentFrameIndex);
+    ResolveGpuTimings(currentFrameIndex);
+    RetireDeletions(false);
+    vkResetCommandPool(logicalDevice, frameCommandPools[currentFrameIndex], 0);
+    vkResetCommandPool(logicalDevice, computeCommandPools[currentFrameIndex], 0);
+
+    VkResult result = VK_SUCCESS;
+    if (headless) // every frame in flight owns one offscreen image
+    {
+        nextImageIndex = currentFrameIndex;
+        shouldPresent = true;
+    }
+    else
+    {
+        result = vkAcquireNextImageKHR(logicalDevice, swapChain.swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrameIndex], VK_NULL_HANDLE, &nextImageIndex);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR)
+            shouldPresent = false;
+        else
+        {
+            Assert(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+            shouldPresent = true;
+        }
+    }
+
+    #if DIAMOND_IMGUI
+    ImGui_ImplVulkan_NewFrame();
+    if (headless) // normally provided by the glfw backend
+    {
+        ImGuiIO& io = ImGui::GetIO();
+        io.DisplaySize = ImVec2(static_cast<f32>(swapChain.swapChainExtent.width), static_cast<f32>(swapChain.swapChainExtent.height));
+        io.DeltaTime = currentFrameDelta > 0.0 ? static_cast<f32>(currentFrameDelta / 1000.0) : 1.f / 60.f;
+    }
+    else
+        ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+    #endif
+
+    // start recording the render command buffer
+    BeginRenderPassBuffer(mainContext.commandBuffers[currentFrameIndex]);
+    ResetContextGeometry(mainContext);
+
+    // the fence for this frame has signaled, so the stream memory it was using can be handed out again
+    for (int i = 0; i < graphicsPipelines.size(); i++)
+    {
+        if (graphicsPipelines[i].enabled)
+        {
+            BeginStreamFrame(graphicsPipelines[i].vertexStream);
+            BeginStreamFrame(graphicsPipelines[i].indexStream);
+        }
+    }
+
+    // start recording compute command buffer
+    VkCommandBufferBeginInfo computeBeginInfo{};
+    computeBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    computeBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    result = vkBeginCommandBuffer(computeBuffers[currentFrameIndex], &computeBeginInfo);
+    Assert(result == VK_SUCCESS);
+    computeDispatched = false;
+    if (computeTimestampMask != 0)
+        vkCmdResetQueryPool(computeBuffers[currentFrameIndex], computeQueryPools[currentFrameIndex], 0, MAX_GPU_TIMESTAMPS);
+
+    // reserved up front so that it is listed before the scopes it contains
+    renderPassScopes[currentFrameIndex] = ReserveGpuScope("Render Pass", 0, false);
+
+    // take back the compute resources which the graphics queue released at the end of the last frame
+    if (ownershipReleased)
+    {
+        std::vector<VkBuffer> buffers;
+        std::vector<VkImage> images;
+        GetSharedComputeResources(buffers, images);
+
+        // resources of pipelines which were deleted in the meantime no longer exist
+        ownershipBuffers.erase(std::remove_if(ownershipBuffers.begin(), ownershipBuffers.end(), [&buffers](VkBuffer buffer) { return std::find(buffers.begin(), buffers.end(), buffer) == buffers.end(); }), ownershipBuffers.end());
+        ownershipImages.erase(std::remove_if(ownershipImages.begin(), ownershipImages.end(), [&images](VkImage image) { return std::find(images.begin(), images.end(), image) == images.end(); }), ownershipImages.end());
+
+        TransferComputeOwnership(
+            computeBuffers[currentFrameIndex],
+            queueFamilies.graphicsFamily.value(), queueFamilies.computeFamily.value(),
+            0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT
+        );
+        ownershipReleased = false;
+    }
+
+    if (asyncCompute)
+        CarryOverComputeBuffers();
 }
 
-void diamond::CreateDescriptorSetLayout()
+void diamond::EndFrame(glm::vec4 clearColor)
 {
-    VkDescriptorSetLayoutBinding uboLayoutBinding{};
-    uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    uboLayoutBinding.pImmutableSamplers = nullptr;
+    DIAMOND_PROFILE_FUNCTION();
 
-    VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-    samplerLayoutBinding.binding = 1;
-    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.descriptorCount = static_cast<u32>(textureArray.size());
-    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-    samplerLayoutBinding.pImmutableSamplers = nullptr;
+    // uploads recorded since the last submission go first, so the frame's submissions on the same queue are ordered after them
+    SubmitUploads();
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
-    VkDescriptorSetLayoutCreateInfo layoutInfo{};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = static_cast<u32>(bindings.size());
-    layoutInfo.pBindings = bindings.data();
+    // textures registered during the frame, which is fine since the texture table is update after bind
+    FlushTextureDescriptorWrites(currentFrameIndex);
 
-    VkResult result = vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &descriptorSetLayout);
-    Assert(result == VK_SUCCESS);
-}
+    // resources which are read by the graphics queue but not double buffered force the compute work to wait for the previous frame's rendering
+    std::vector<VkBuffer> sharedBuffers;
+    std::vector<VkImage> sharedImages;
+    GetSharedComputeResources(sharedBuffers, sharedImages);
+    bool waitOnGraphics = !asyncCompute || !sharedBuffers.empty() || !sharedImages.empty();
 
-void diamond::CreateComputeDescriptorSetLayout(diamond_compute_pipeline& pipeline, int bufferCount, int imageCount)
-{
-    std::vector<VkDescriptorSetLayoutBinding> bindings(bufferCount + imageCount);
-    for (int i = 0; i < bufferCount; i++)
+    // hand the resources the graphics queue reads over to its family when the compute queue lives in a different one
+    bool transferOwnership = shouldPresent && queueFamilies.computeFamily.value() != queueFamilies.graphicsFamily.value();
+    if (transferOwnership)
     {
-        bindings[i].binding = i;
-        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        bindings[i].descriptorCount = 1;
-        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-        bindings[i].pImmutableSamplers = nullptr;
+        ownershipBuffers = sharedBuffers;
+        ownershipImages = sharedImages;
+        TransferComputeOwnership(
+            computeBuffers[currentFrameIndex],
+            queueFamilies.computeFamily.value(), queueFamilies.graphicsFamily.value(),
+            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+        );
     }
-    for (int i = bufferCount; i < bufferCount + imageCount; i++)
+
+    // end compute buffer
+    VkResult result = vkEndCommandBuffer(computeBuffers[currentFrameIndex]);
+    Assert(result == VK_SUCCESS);
+
+    // submit to queue. The compute work must not overwrite anything the previous frame's graphics work is still reading, and
+    // this frame's graphics submission waits on the signaled value before consuming the results. With async compute every shared
+    // buffer has a copy per frame in flight, so the work can overlap with the rendering of the previous frame instead
     {
-        bindings[i].binding = i;
-        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-        bindings[i].descriptorCount = 1;
-        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-        bindings[i].pImmutableSamplers = nullptr;
+        computeTimelineValue++;
+        computeFrameValues[currentFrameIndex] = computeTimelineValue;
+
+        VkPipelineStageFlags waitFlags = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = waitOnGraphics ? 1 : 0;
+        timelineInfo.pWaitSemaphoreValues = &graphicsTimelineValue;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &computeTimelineValue;
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = waitOnGraphics ? 1 : 0;
+        submitInfo.pWaitSemaphores = &graphicsTimeline;
+        submitInfo.pWaitDstStageMask = &waitFlags;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &computeBuffers[currentFrameIndex];
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &computeTimeline;
+        result = vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        Assert(result == VK_SUCCESS);
     }
 
-    VkDescriptorSetLayoutCreateInfo layoutInfo{};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = static_cast<u32>(bindings.size());
-    layoutInfo.pBindings = bindings.data();
+    Assert(mainContext.openGpuScopes.empty()); // every BeginGpuScope() needs a matching EndGpuScope()
+    result = vkEndCommandBuffer(mainContext.commandBuffers[currentFrameIndex]);
+    Assert(result == VK_SUCCESS);
 
-    VkResult result = vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &pipeline.descriptorSetLayout);
+    #if DIAMOND_IMGUI
+    BeginRenderPassBuffer(overlayBuffers[currentFrameIndex]);
+    int overlayScope = ReserveGpuScope("ImGui", 1, false);
+    WriteGpuTimestamp(overlayBuffers[currentFrameIndex], overlayScope, false);
+    ImGui::Render();
+    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), overlayBuffers[currentFrameIndex]);
+    WriteGpuTimestamp(overlayBuffers[currentFrameIndex], overlayScope, true);
+    result = vkEndCommandBuffer(overlayBuffers[currentFrameIndex]);
     Assert(result == VK_SUCCESS);
-}
+    #endif
 
-void diamond::CreateRenderPass()
-{
-    VkAttachmentDescription depthAttachment{};
-    depthAttachment.format = VK_FORMAT_D32_SFLOAT;
-    depthAttachment.samples = msaaSamples;
-    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    // the main context goes first, followed by the recording contexts in a deterministic order regardless of which thread finished first
+    std::vector<int> contextOrder;
+    for (int i = 0; i < recordingContexts.size(); i++)
+    {
+        Assert(!recordingContexts[i].recording); // EndRecording() must be called before EndFrame()
+        if (recordingContexts[i].enabled && recordingContexts[i].recorded)
+            contextOrder.push_back(i);
+        recordingContexts[i].recorded = false;
+    }
+    std::stable_sort(contextOrder.begin(), contextOrder.end(), [this](int a, int b) { return recordingContexts[a].order < recordingContexts[b].order; });
 
-    VkAttachmentDescription colorAttachment{};
-    colorAttachment.format = swapChain.swapChainImageFormat;
-    colorAttachment.samples = msaaSamples;
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    std::vector<VkCommandBuffer> renderPassBuffers = { mainContext.commandBuffers[currentFrameIndex] };
+    for (int index : contextOrder)
+    {
+        renderPassBuffers.push_back(recordingContexts[index].commandBuffers[currentFrameIndex]);
+    }
+    #if DIAMOND_IMGUI
+    renderPassBuffers.push_back(overlayBuffers[currentFrameIndex]);
+    #endif
 
-    VkAttachmentDescription colorAttachmentResolve{};
-    colorAttachmentResolve.format = swapChain.swapChainImageFormat;
-    colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
-    colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // only record the primary buffer for the frame in flight, targeting the image which was acquired
+    if (shouldPresent)
+    {
+        VkCommandBuffer commandBuffer = commandBuffers[currentFrameIndex];
 
-    VkAttachmentReference colorAttachmentRef{};
-    colorAttachmentRef.attachment = 0;
-    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = nullptr; // Optional
 
-    VkAttachmentReference colorAttachmentResolveRef{};
-    colorAttachmentResolveRef.attachment = 1;
-    colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        Assert(result == VK_SUCCESS);
 
-    VkAttachmentReference depthAttachmentRef{};
-    depthAttachmentRef.attachment = 2;
-    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = renderPass;
+        renderPassInfo.framebuffer = swapChain.swapChainFrameBuffers[nextImageIndex];
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = swapChain.swapChainExtent;
 
-    VkSubpassDescription subpass{};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
-    subpass.pResolveAttachments = &colorAttachmentResolveRef;
-    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+        std::array<VkClearValue, 3> clearValues{};
+        clearValues[0].color = { clearColor.r, clearColor.g, clearColor.b, clearColor.a };
+        clearValues[1].color = { clearColor.r, clearColor.g, clearColor.b, clearColor.a };
+        clearValues[2].depthStencil = { 1.f, 0 };
+        renderPassInfo.clearValueCount = static_cast<u32>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
 
-    VkSubpassDependency dependency{};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        AcquireUploads(commandBuffer);
 
-    std::array<VkAttachmentDescription, 3> attachments = { colorAttachment, colorAttachmentResolve, depthAttachment };
-    VkRenderPassCreateInfo renderPassInfo{};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = static_cast<u32>(attachments.size());
-    renderPassInfo.pAttachments = attachments.data();
-    renderPassInfo.subpassCount = 1;
-    renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+        if (transferOwnership)
+        {
+            TransferComputeOwnership(
+                commandBuffer,
+                queueFamilies.computeFamily.value(), queueFamilies.graphicsFamily.value(),
+                0, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT
+            );
+        }
 
-    VkResult result = vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, &renderPass);
-    Assert(result == VK_SUCCESS);
-}
+        // compute images which were written this frame get their mips rebuilt before anything samples them
+        GenerateComputeMips(commandBuffer);
 
-void diamond::CreateUniformBuffers()
-{
-    VkDeviceSize bufferSize = sizeof(diamond_frame_buffer_object);
-    
-    uniformBuffers.resize(swapChain.swapChainImages.size());
-    uniformBuffersMemory.resize(swapChain.swapChainImages.size());
+        // the secondary buffers write their timestamps after this in submission order
+        if (graphicsTimestampMask != 0)
+            vkCmdResetQueryPool(commandBuffer, graphicsQueryPools[currentFrameIndex], 0, MAX_GPU_TIMESTAMPS);
 
-    for (int i = 0; i < swapChain.swapChainImages.size(); i++)
+        WriteGpuTimestamp(commandBuffer, renderPassScopes[currentFrameIndex], false);
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+        vkCmdExecuteCommands(commandBuffer, static_cast<u32>(renderPassBuffers.size()), renderPassBuffers.data());
+
+        vkCmdEndRenderPass(commandBuffer);
+        WriteGpuTimestamp(commandBuffer, renderPassScopes[currentFrameIndex], true);
+
+        // and give them back so the next frame's compute work can use them again
+        if (transferOwnership)
+        {
+            TransferComputeOwnership(
+                commandBuffer,
+                queueFamilies.graphicsFamily.value(), queueFamilies.computeFamily.value(),
+                0, 0,
+                VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+            );
+            ownershipReleased = true;
+        }
+        
+        result = vkEndCommandBuffer(commandBuffer);
+        Assert(result == VK_SUCCESS);
+    }
+
+    if (shouldPresent)
+        Present();
+    else
+        RecreateSwapChain();
+    currentFrameIndex = (currentFrameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    double dt = std::max((double)(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - frameStartTime)).count(), 0.0);
+    currentFrameDelta = dt * pow(10, -6);
+    AddFrameSample(cpuFrameTimes, currentFrameDelta);
+    deltaTimes[frameCount] = currentFrameDelta;
+    frameCount++;
+
+    if (frameCount == deltaTimes.size())
     {
-        CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+        std::sort(deltaTimes.begin(), deltaTimes.end());
+        double avg = 0.f;
+        for (int i = 2; i < deltaTimes.size() - 3; i++)
+        {
+            avg += deltaTimes[i];
+        }
+        avg /= deltaTimes.size() - 6;
+
+        frameDelta = avg;
+        fps = 1.f / (frameDelta / 1000.f);
+
+        frameCount = 0;
     }
 }
 
-VkPipelineShaderStageCreateInfo diamond::CreateShaderStage(VkShaderModule shaderModule, VkShaderStageFlagBits stage, const char* entrypoint)
+void diamond::SetGraphicsPipeline(int pipelineIndex)
 {
-    VkPipelineShaderStageCreateInfo shaderStageInfo{};
-    shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    shaderStageInfo.stage = stage;
-    shaderStageInfo.module = shaderModule;
-    shaderStageInfo.pName = entrypoint;
-    shaderStageInfo.pSpecializationInfo = nullptr;
+    diamond_recording_context& context = CurrentContext();
+    VkCommandBuffer commandBuffer = context.commandBuffers[currentFrameIndex];
 
-    return shaderStageInfo;
+    // the geometry buffers are bound once the context first binds data this frame, since the streams may grow in the meantime
+    const diamond_recording_geometry& geometry = context.geometry[pipelineIndex];
+    VkDeviceSize offsets[] = { 0 };
+    if (geometry.vertexBuffer != VK_NULL_HANDLE)
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &geometry.vertexBuffer, offsets);
+    if (geometry.indexBuffer != VK_NULL_HANDLE)
+        vkCmdBindIndexBuffer(commandBuffer, geometry.indexBuffer, 0, graphicsPipelines[pipelineIndex].pipelineInfo.indexType);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelines[pipelineIndex].pipeline);
+
+    // todo: move to beginframe ?
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelines[pipelineIndex].pipelineLayout, 0, 1, &descriptorSets[currentFrameIndex], 0, nullptr);
+
+    context.boundGraphicsPipelineIndex = pipelineIndex;
 }
 
-VkShaderModule diamond::CreateShaderModule(const char* ShaderPath)
+int diamond::CreateRecordingContext(int order)
 {
-    std::ifstream file(ShaderPath, std::ios::ate | std::ios::binary);
-    Assert(file.is_open())
-    
-    u64 fileSize = file.tellg();
-    std::vector<char> buffer(fileSize);
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-    file.close();
+    diamond_recording_context context = {};
+    context.order = order;
+    context.commandPools.resize(MAX_FRAMES_IN_FLIGHT);
+    context.commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        // command pools must only ever be used by one thread at a time, so every context gets its own
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = queueFamilies.graphicsFamily.value();
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-    VkShaderModuleCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = buffer.size();
-    createInfo.pCode = reinterpret_cast<const u32*>(buffer.data());
+        VkResult result = vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &context.commandPools[i]);
+        Assert(result == VK_SUCCESS);
 
-    VkShaderModule module;
-    VkResult result = vkCreateShaderModule(logicalDevice, &createInfo, nullptr, &module);
-    Assert(result == VK_SUCCESS);
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = context.commandPools[i];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
 
-    return module;
+        result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &context.commandBuffers[i]);
+        Assert(result == VK_SUCCESS);
+    }
+
+    for (int i = 0; i < recordingContexts.size(); i++)
+    {
+        if (!recordingContexts[i].enabled)
+        {
+            recordingContexts[i] = context;
+            return i;
+        }
+    }
+
+    recordingContexts.push_back(context);
+    return static_cast<int>(recordingContexts.size() - 1);
 }
 
-bool diamond::CheckDeviceExtensionSupport(VkPhysicalDevice device)
+void diamond::DeleteRecordingContext(int contextIndex)
 {
-    // get hardware extension support
-    u32 supportedExtensionCount = 0;
-    vkEnumerateDeviceExtensionProperties(device, nullptr, &supportedExtensionCount, nullptr);
-    std::vector<VkExtensionProperties> supportedExtensions(supportedExtensionCount);
-    vkEnumerateDeviceExtensionProperties(device, nullptr, &supportedExtensionCount, supportedExtensions.data());
-
-    // check for compatability
-    int count = 0;
-    for (int i = 0; i < deviceExtensions.size(); i++)
+    diamond_recording_context& context = recordingContexts[contextIndex];
+    if (context.enabled)
     {
-        if (std::find_if(supportedExtensions.begin(), supportedExtensions.end(), [this, &i](const VkExtensionProperties& arg) { return strcmp(arg.extensionName, deviceExtensions[i]); }) == supportedExtensions.end())
-            return false;
+        // the frames in flight may still be executing buffers recorded from these pools
+        diamond_deferred_deletion& deletion = DeferredDeletion();
+        deletion.commandPools.insert(deletion.commandPools.end(), context.commandPools.begin(), context.commandPools.end());
+        context.commandPools.clear();
+        context.commandBuffers.clear();
+        context.enabled = false;
     }
+}
 
-    return true;
+void diamond::BeginRecording(int contextIndex)
+{
+    diamond_recording_context& context = recordingContexts[contextIndex];
+    Assert(context.enabled && !context.recording && threadContextIndex == -1);
+
+    // BeginFrame() already waited on this frame's fence, so nothing recorded into the pool last time around is in use anymore
+    vkResetCommandPool(logicalDevice, context.commandPools[currentFrameIndex], 0);
+    BeginRenderPassBuffer(context.commandBuffers[currentFrameIndex]);
+    ResetContextGeometry(context);
+
+    context.recording = true;
+    threadContextIndex = contextIndex;
 }
 
-VkSampleCountFlagBits diamond::GetMaxSampleCount()
+void diamond::EndRecording()
 {
-    VkPhysicalDeviceProperties physicalDeviceProperties;
-    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+    Assert(threadContextIndex != -1);
+    diamond_recording_context& context = recordingContexts[threadContextIndex];
+    Assert(context.openGpuScopes.empty()); // every BeginGpuScope() needs a matching EndGpuScope()
 
-    VkSampleCountFlags counts = physicalDeviceProperties.limits.framebufferColorSampleCounts & physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+    VkResult result = vkEndCommandBuffer(context.commandBuffers[currentFrameIndex]);
+    Assert(result == VK_SUCCESS);
 
-    if (counts & VK_SAMPLE_COUNT_64_BIT) { return VK_SAMPLE_COUNT_64_BIT; }
-    if (counts & VK_SAMPLE_COUNT_32_BIT) { return VK_SAMPLE_COUNT_32_BIT; }
-    if (counts & VK_SAMPLE_COUNT_16_BIT) { return VK_SAMPLE_COUNT_16_BIT; }
-    if (counts & VK_SAMPLE_COUNT_8_BIT) { return VK_SAMPLE_COUNT_8_BIT; }
-    if (counts & VK_SAMPLE_COUNT_4_BIT) { return VK_SAMPLE_COUNT_4_BIT; }
-    if (counts & VK_SAMPLE_COUNT_2_BIT) { return VK_SAMPLE_COUNT_2_BIT; }
+    context.recording = false;
+    context.recorded = true;
+    threadContextIndex = -1;
+}
 
-    return VK_SAMPLE_COUNT_1_BIT;
+diamond_recording_context& diamond::CurrentContext()
+{
+    if (threadContextIndex == -1)
+        return mainContext;
+    return recordingContexts[threadContextIndex];
 }
 
-bool diamond::IsDeviceSuitable(VkPhysicalDevice device)
+void diamond::BeginGpuScope(const char* name)
 {
-    VkPhysicalDeviceProperties deviceProperties;
-    vkGetPhysicalDeviceProperties(device, &deviceProperties);
-    VkPhysicalDeviceFeatures deviceFeatures;
-    vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-    diamond_queue_family_indices indices = GetQueueFamilies(device);
+    diamond_recording_context& context = CurrentContext();
 
-    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
-    indexingFeatures.sType	= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
-    indexingFeatures.pNext = nullptr;
-    VkPhysicalDeviceFeatures2 deviceFeatures2{};
-    deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
-    deviceFeatures2.pNext = &indexingFeatures;
-    vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+    // recording contexts are executed inside of the render pass scope
+    int scope = ReserveGpuScope(name, static_cast<int>(context.openGpuScopes.size()) + 1, false);
+    WriteGpuTimestamp(context.commandBuffers[currentFrameIndex], scope, false);
+    context.openGpuScopes.push_back(scope);
+}
 
-    bool extensionsSupported = CheckDeviceExtensionSupport(device);
-    bool swapChainAdequate = false;
-    if (extensionsSupported)
+void diamond::EndGpuScope()
+{
+    diamond_recording_context& context = CurrentContext();
+    Assert(!context.openGpuScopes.empty());
+
+    WriteGpuTimestamp(context.commandBuffers[currentFrameIndex], context.openGpuScopes.back(), true);
+    context.openGpuScopes.pop_back();
+}
+
+#if DIAMOND_IMGUI
+void diamond::DrawGpuProfiler()
+{
+    ImGui::Begin("GPU Profiler");
+    ImGui::Text("Frame: %.3f ms (gpu) %.3f ms (cpu)", gpuFrameDelta, frameDelta);
+    ImGui::Separator();
+    for (int i = 0; i < gpuTimings.size(); i++)
     {
-        diamond_swap_chain_support_details swapDetails = GetSwapChainSupport(device);
-        swapChainAdequate = !swapDetails.formats.empty() && !swapDetails.presentModes.empty();
+        const diamond_gpu_timing& timing = gpuTimings[i];
+        ImGui::Text("%*s%s%s: %.3f ms", timing.depth * 2, "", timing.name.c_str(), timing.compute ? " (compute)" : "", timing.time);
     }
-
-    return (
-        indices.IsComplete() &&
-        extensionsSupported &&
-        swapChainAdequate &&
-        deviceFeatures.samplerAnisotropy &&
-        deviceFeatures.shaderSampledImageArrayDynamicIndexing &&
-        indexingFeatures.descriptorBindingPartiallyBound &&
-        indexingFeatures.runtimeDescriptorArray
-    );
+    ImGui::End();
 }
+#endif
 
-VkSurfaceFormatKHR diamond::ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats)
+void diamond::ConfigureFrameStats(int windowSize, double hitchBudget)
 {
-    for (const auto& availableFormat : formats)
+    Assert(windowSize > 0);
+
+    frameHitchBudget = hitchBudget;
+    for (diamond_frame_histogram* histogram : { &cpuFrameTimes, &presentIntervals, &gpuFrameTimes })
     {
-        if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-            return availableFormat;
+        *histogram = diamond_frame_histogram();
+        histogram->buckets.resize(FRAME_HISTOGRAM_BUCKET_COUNT, 0);
+        histogram->samples.resize(windowSize, 0.f);
     }
+}
 
-    return formats[0];
+diamond_frame_stats diamond::GetFrameStats()
+{
+    diamond_frame_stats stats;
+    stats.cpu = GetFrameTimingStats(cpuFrameTimes);
+    stats.presentInterval = GetFrameTimingStats(presentIntervals);
+    stats.gpu = GetFrameTimingStats(gpuFrameTimes);
+    stats.hitchBudget = frameHitchBudget;
+    return stats;
 }
 
-VkPresentModeKHR diamond::ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& presentModes)
+#if DIAMOND_IMGUI
+void diamond::DrawFrameStats()
 {
-    for (const auto& availablePresentMode : presentModes)
+    diamond_frame_stats stats = GetFrameStats();
+
+    ImGui::Begin("Frame Stats");
+    ImGui::Text("Window: %d frames, hitch budget: %.2f ms", static_cast<int>(cpuFrameTimes.samples.size()), stats.hitchBudget);
+    ImGui::Separator();
+    ImGui::Text("%-9s %8s %8s %8s %8s %8s", "(ms)", "p50", "p95", "p99", "max", "hitches");
+    std::array<std::pair<const char*, diamond_frame_timing_stats*>, 3> rows = {{
+        { "CPU", &stats.cpu },
+        { "Present", &stats.presentInterval },
+        { "GPU", &stats.gpu }
+    }};
+    for (auto& row : rows)
     {
-        if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-            return availablePresentMode;
+        ImGui::Text("%-9s %8.2f %8.2f %8.2f %8.2f %8d", row.first, row.second->p50, row.second->p95, row.second->p99, row.second->max, row.second->hitchCount);
     }
 
-    return VK_PRESENT_MODE_FIFO_KHR;
+    // oldest sample first
+    int offset = cpuFrameTimes.sampleCount == cpuFrameTimes.samples.size() ? cpuFrameTimes.nextSample : 0;
+    ImGui::PlotLines("CPU", cpuFrameTimes.samples.data(), cpuFrameTimes.sampleCount, offset, nullptr, 0.f, static_cast<f32>(stats.hitchBudget * 2.0), ImVec2(0.f, 80.f));
+    ImGui::End();
 }
+#endif
 
-VkExtent2D diamond::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+void diamond::AddFrameSample(diamond_frame_histogram& histogram, double sample)
 {
-    if (capabilities.currentExtent.width != UINT32_MAX)
-        return capabilities.currentExtent;
-    else
+    auto bucket = [this](double value) { return std::min(static_cast<int>(value / FRAME_HISTOGRAM_BUCKET_WIDTH), FRAME_HISTOGRAM_BUCKET_COUNT - 1); };
+
+    // the oldest sample falls out of the window once it is full
+    if (histogram.sampleCount == histogram.samples.size())
     {
-        int width, height;
-        glfwGetFramebufferSize(window, &width, &height);
-        VkExtent2D actualExtent = {
-            static_cast<u32>(width),
-            static_cast<u32>(height)
-        };
+        f32 oldest = histogram.samples[histogram.nextSample];
+        histogram.buckets[bucket(oldest)]--;
+        if (oldest > frameHitchBudget)
+            histogram.hitchCount--;
+    }
+    else
+        histogram.sampleCount++;
+
+    f32 value = static_cast<f32>(std::max(sample, 0.0));
+    histogram.samples[histogram.nextSample] = value;
+    histogram.nextSample = (histogram.nextSample + 1) % static_cast<int>(histogram.samples.size());
+    histogram.buckets[bucket(value)]++;
+    if (value > frameHitchBudget)
+        histogram.hitchCount++;
+}
 
-        actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
-        actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+diamond_frame_timing_stats diamond::GetFrameTimingStats(const diamond_frame_histogram& histogram)
+{
+    diamond_frame_timing_stats stats;
+    stats.sampleCount = histogram.sampleCount;
+    stats.hitchCount = histogram.hitchCount;
+    if (histogram.sampleCount == 0)
+        return stats;
 
-        return actualExtent;
+    for (int i = 0; i < histogram.sampleCount; i++)
+    {
+        stats.average += histogram.samples[i];
+        stats.max = std::max(stats.max, static_cast<double>(histogram.samples[i]));
+    }
+    stats.average /= histogram.sampleCount;
+
+    // report the upper edge of the bucket the percentile falls into, which is never above the largest sample. The last bucket
+    // also holds every longer sample, so percentiles falling into it are taken from the samples themselves
+    std::array<double, 3> percentiles = { 0.5, 0.95, 0.99 };
+    std::array<double*, 3> results = { &stats.p50, &stats.p95, &stats.p99 };
+    std::vector<f32> overflow;
+    int current = 0;
+    u32 cumulative = 0;
+    for (int i = 0; i < histogram.buckets.size() && current < percentiles.size(); i++)
+    {
+        cumulative += histogram.buckets[i];
+        while (current < percentiles.size() && cumulative >= static_cast<u32>(ceil(percentiles[current] * histogram.sampleCount)))
+        {
+            if (i == FRAME_HISTOGRAM_BUCKET_COUNT - 1)
+            {
+                if (overflow.empty())
+                {
+                    // same bucketing as AddFrameSample(), so these are exactly the samples counted by the bucket
+                    for (int j = 0; j < histogram.sampleCount; j++)
+                    {
+                        if (static_cast<int>(histogram.samples[j] / FRAME_HISTOGRAM_BUCKET_WIDTH) >= i)
+                            overflow.push_back(histogram.samples[j]);
+                    }
+                }
+                int rank = static_cast<int>(ceil(percentiles[current] * histogram.sampleCount)) - static_cast<int>(cumulative - histogram.buckets[i]) - 1;
+                rank = std::min(std::max(rank, 0), static_cast<int>(overflow.size()) - 1);
+                std::nth_element(overflow.begin(), overflow.begin() + rank, overflow.end());
+                *results[current] = overflow[rank];
+            }
+            else
+                *results[current] = std::min((i + 1) * FRAME_HISTOGRAM_BUCKET_WIDTH, stats.max);
+            current++;
+        }
     }
+
+    return stats;
 }
 
-void diamond::MapMemory(void* data, u32 dataSize, u32 elementCount, VkDeviceMemory bufferMemory, u32 elementMemoryOffset)
+void diamond::CreateQueryPools()
 {
-    void* buffer;
-    vkMapMemory(logicalDevice, bufferMemory, elementMemoryOffset * dataSize, dataSize * elementCount, 0, &buffer);
-    memcpy(buffer, data, dataSize * elementCount);
-    vkUnmapMemory(logicalDevice, bufferMemory);
+    u32 supportedQueueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &supportedQueueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> supportedQueueFamilies(supportedQueueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &supportedQueueFamilyCount, supportedQueueFamilies.data());
+
+    // only the valid bits of a timestamp count, which also handles the counter wrapping around between two queries
+    auto timestampMask = [](u32 validBits) { return validBits >= 64 ? ~0ull : (1ull << validBits) - 1; };
+    graphicsTimestampMask = timestampMask(supportedQueueFamilies[queueFamilies.graphicsFamily.value()].timestampValidBits);
+    computeTimestampMask = timestampMask(supportedQueueFamilies[queueFamilies.computeFamily.value()].timestampValidBits);
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = MAX_GPU_TIMESTAMPS;
+
+    graphicsQueryPools.resize(MAX_FRAMES_IN_FLIGHT);
+    computeQueryPools.resize(MAX_FRAMES_IN_FLIGHT);
+    gpuScopes.resize(MAX_FRAMES_IN_FLIGHT);
+    graphicsQueryCounts.resize(MAX_FRAMES_IN_FLIGHT, 0);
+    computeQueryCounts.resize(MAX_FRAMES_IN_FLIGHT, 0);
+    graphicsQueriesSubmitted.resize(MAX_FRAMES_IN_FLIGHT, false);
+    renderPassScopes.resize(MAX_FRAMES_IN_FLIGHT, -1);
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        VkResult result = vkCreateQueryPool(logicalDevice, &poolInfo, nullptr, &graphicsQueryPools[i]);
+        Assert(result == VK_SUCCESS);
+        result = vkCreateQueryPool(logicalDevice, &poolInfo, nullptr, &computeQueryPools[i]);
+        Assert(result == VK_SUCCESS);
+    }
 }
 
-void diamond::SetCameraViewMatrix(glm::mat4 matrix)
+int diamond::ReserveGpuScope(const char* name, int depth, bool compute, int computePipelineIndex)
 {
-    cameraViewMatrix = matrix;
+    if ((compute ? computeTimestampMask : graphicsTimestampMask) == 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(gpuScopeMutex);
+    u32& queryCount = compute ? computeQueryCounts[currentFrameIndex] : graphicsQueryCounts[currentFrameIndex];
+    if (queryCount + 2 > MAX_GPU_TIMESTAMPS)
+        return -1;
+
+    diamond_gpu_scope scope;
+    if (name != nullptr)
+        scope.name = name;
+    scope.computePipelineIndex = computePipelineIndex;
+    scope.depth = depth;
+    scope.compute = compute;
+    scope.beginQuery = queryCount;
+    scope.endQuery = queryCount + 1;
+    queryCount += 2;
+
+    gpuScopes[currentFrameIndex].push_back(scope);
+    return static_cast<int>(gpuScopes[currentFrameIndex].size() - 1);
 }
 
-void diamond::UpdateCameraViewMode(diamond_camera_mode camMode, glm::vec2 camDimensions)
+void diamond::WriteGpuTimestamp(VkCommandBuffer cmd, int scopeIndex, bool end)
 {
-    cameraMode = camMode;
-    cameraDimensions = camDimensions;
+    if (scopeIndex == -1)
+        return;
+
+    // other threads may be growing the scope list
+    std::lock_guard<std::mutex> lock(gpuScopeMutex);
+    const diamond_gpu_scope& scope = gpuScopes[currentFrameIndex][scopeIndex];
+    vkCmdWriteTimestamp(
+        cmd,
+        end ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        scope.compute ? computeQueryPools[currentFrameIndex] : graphicsQueryPools[currentFrameIndex],
+        end ? scope.endQuery : scope.beginQuery
+    );
 }
 
-void diamond::BeginFrame()
+void diamond::ResolveGpuTimings(int frameIndex)
 {
-    frameStartTime = std::chrono::high_resolution_clock::now();
-
-    glfwPollEvents();
+    // called once the frame's fence and compute timeline value have been waited on, so every submitted query is already available
+    std::vector<u64> graphicsResults(graphicsQueryCounts[frameIndex]);
+    std::vector<u64> computeResults(computeQueryCounts[frameIndex]);
+    bool graphicsAvailable = false;
+    bool computeAvailable = false;
+    if (graphicsQueriesSubmitted[frameIndex] && !graphicsResults.empty())
+    {
+        VkResult result = vkGetQueryPoolResults(logicalDevice, graphicsQueryPools[frameIndex], 0, static_cast<u32>(graphicsResults.size()), graphicsResults.size() * sizeof(u64), graphicsResults.data(), sizeof(u64), VK_QUERY_RESULT_64_BIT);
+        graphicsAvailable = result == VK_SUCCESS;
+    }
+    if (!computeResults.empty())
+    {
+        VkResult result = vkGetQueryPoolResults(logicalDevice, computeQueryPools[frameIndex], 0, static_cast<u32>(computeResults.size()), computeResults.size() * sizeof(u64), computeResults.data(), sizeof(u64), VK_QUERY_RESULT_64_BIT);
+        computeAvailable = result == VK_SUCCESS;
+    }
 
-    VkResult result = vkAcquireNextImageKHR(logicalDevice, swapChain.swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrameIndex], VK_NULL_HANDLE, &nextImageIndex);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR)
-        shouldPresent = false;
-    else
+    // keep showing the last resolved frame if there is nothing new
+    if (graphicsAvailable || computeAvailable)
     {
-        Assert(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
-        shouldPresent = true;
+        gpuTimings.clear();
+        const std::vector<diamond_gpu_scope>& scopes = gpuScopes[frameIndex];
+        for (int i = 0; i < scopes.size(); i++)
+        {
+            if (scopes[i].compute ? !computeAvailable : !graphicsAvailable)
+                continue;
+
+            const std::vector<u64>& results = scopes[i].compute ? computeResults : graphicsResults;
+            u64 mask = scopes[i].compute ? computeTimestampMask : graphicsTimestampMask;
+            u64 ticks = (results[scopes[i].endQuery] - results[scopes[i].beginQuery]) & mask;
+
+            // dispatches only store their pipeline index so that timing them doesn't allocate
+            diamond_gpu_timing timing;
+            if (scopes[i].computePipelineIndex != -1)
+                timing.name = "Compute Pipeline " + std::to_string(scopes[i].computePipelineIndex);
+            else
+                timing.name = scopes[i].name;
+            timing.depth = scopes[i].depth;
+            timing.compute = scopes[i].compute;
+            timing.time = ticks * static_cast<double>(physicalDeviceProperties.limits.timestampPeriod) * pow(10, -6);
+            if (i == renderPassScopes[frameIndex])
+            {
+                gpuFrameDelta = timing.time;
+                AddFrameSample(gpuFrameTimes, gpuFrameDelta);
+            }
+            gpuTimings.push_back(timing);
+        }
     }
 
-    #if DIAMOND_IMGUI
-    ImGui_ImplVulkan_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
-    #endif
+    gpuScopes[frameIndex].clear();
+    graphicsQueryCounts[frameIndex] = 0;
+    computeQueryCounts[frameIndex] = 0;
+    graphicsQueriesSubmitted[frameIndex] = false;
+    renderPassScopes[frameIndex] = -1;
+}
 
-    // start recording the render command buffer
+void diamond::BeginRenderPassBuffer(VkCommandBuffer buffer)
+{
     VkCommandBufferInheritanceInfo inheritanceInfo{};
     inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
     inheritanceInfo.pNext = nullptr;
@@ -2265,14 +5168,13 @@ void diamond::BeginFrame()
 
     VkCommandBufferBeginInfo secondaryBeginInfo{};
     secondaryBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    secondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    secondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     secondaryBeginInfo.pInheritanceInfo = &inheritanceInfo;
 
-    result = vkBeginCommandBuffer(renderPassBuffer, &secondaryBeginInfo);
+    VkResult result = vkBeginCommandBuffer(buffer, &secondaryBeginInfo);
     Assert(result == VK_SUCCESS);
 
-    boundGraphicsPipelineIndex = -1;
-
+    // dynamic state is not inherited by secondary command buffers
     VkViewport viewport{};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
@@ -2280,171 +5182,215 @@ void diamond::BeginFrame()
     viewport.height = (float) swapChain.swapChainExtent.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(renderPassBuffer, 0, 1, &viewport);
+    vkCmdSetViewport(buffer, 0, 1, &viewport);
 
     VkRect2D scissor{};
     scissor.offset = {0, 0};
     scissor.extent = swapChain.swapChainExtent;
-    vkCmdSetScissor(renderPassBuffer, 0, 1, &scissor);
-
-    for (int i = 0; i < graphicsPipelines.size(); i++)
-    {
-        graphicsPipelines[i].boundIndexCount = 0;
-        graphicsPipelines[i].boundVertexCount = 0;
-    }
-
-    // start recording compute command buffer
-    VkCommandBufferBeginInfo computeBeginInfo{};
-    computeBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    result = vkBeginCommandBuffer(computeBuffer, &computeBeginInfo);
-    Assert(result == VK_SUCCESS);
+    vkCmdSetScissor(buffer, 0, 1, &scissor);
 }
 
-void diamond::EndFrame(glm::vec4 clearColor)
+void diamond::ResetContextGeometry(diamond_recording_context& context)
 {
-    #if DIAMOND_IMGUI
-    ImGui::Render();
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), renderPassBuffer);
-    #endif
+    // pipelines may have been created since the context was last recorded
+    context.boundGraphicsPipelineIndex = -1;
+    context.geometry.assign(graphicsPipelines.size(), diamond_recording_geometry());
+}
 
-    // end compute buffer
-    VkResult result = vkEndCommandBuffer(computeBuffer);
+void diamond::MemoryBarrier(VkCommandBuffer cmd, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask)
+{
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    vkCmdPipelineBarrier(cmd, srcStageMask, dstStageMask, false, 1, &barrier, 0, nullptr, 0, nullptr);
+}
 
-    // submit to queue
-    vkResetFences(logicalDevice, 1, &computeFence);
-    VkPipelineStageFlags waitFlags = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &computeBuffer;
-    submitInfo.pWaitDstStageMask = &waitFlags;
-    vkQueueSubmit(computeQueue, 1, &submitInfo, computeFence);
-    //vkWaitForFences(logicalDevice, 1, &computeFence, true, UINT64_MAX); // optionally wait for queue fence
+bool diamond::IsComputeBufferDoubleBuffered(const diamond_compute_buffer_info& bufferInfo)
+{
+    return asyncCompute && bufferInfo.staging && bufferInfo.bindVertexBuffer;
+}
 
-    result = vkEndCommandBuffer(renderPassBuffer);
-    Assert(result == VK_SUCCESS);
+VkBuffer diamond::GetComputeDeviceBuffer(const diamond_compute_pipeline& pipeline, int bufferIndex, int frameIndex)
+{
+    const diamond_compute_buffer_info& bufferInfo = pipeline.pipelineInfo.bufferInfoList[bufferIndex];
+    if (!bufferInfo.staging)
+        return pipeline.buffers[bufferIndex];
+    if (frameIndex == 0 || !IsComputeBufferDoubleBuffered(bufferInfo))
+        return pipeline.deviceBuffers[bufferIndex];
+    return pipeline.frameDeviceBuffers[bufferIndex * (MAX_FRAMES_IN_FLIGHT - 1) + frameIndex - 1];
+}
 
-    // start command buffers and render recorded renderBuffer
-    for (int i = 0; i < commandBuffers.size(); i++)
+void diamond::CarryOverComputeBuffers()
+{
+    // each frame in flight simulates on its own copy of the double buffered buffers, so start from where the previous frame left off
+    int previousFrameIndex = (currentFrameIndex + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+    std::vector<VkBuffer> copied;
+    for (int i = 0; i < computePipelines.size(); i++)
     {
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = 0; // Optional
-        beginInfo.pInheritanceInfo = nullptr; // Optional
-
-        result = vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
-        Assert(result == VK_SUCCESS);
-
-        VkRenderPassBeginInfo renderPassInfo{};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = swapChain.swapChainFrameBuffers[i];
-        renderPassInfo.renderArea.offset = {0, 0};
-        renderPassInfo.renderArea.extent = swapChain.swapChainExtent;
-
-        std::array<VkClearValue, 3> clearValues{};
-        clearValues[0].color = { clearColor.r, clearColor.g, clearColor.b, clearColor.a };
-        clearValues[1].color = { clearColor.r, clearColor.g, clearColor.b, clearColor.a };
-        clearValues[2].depthStencil = { 1.f, 0 };
-        renderPassInfo.clearValueCount = 1;
-        renderPassInfo.clearValueCount = static_cast<u32>(clearValues.size());
-        renderPassInfo.pClearValues = clearValues.data();
+        const diamond_compute_pipeline& pipeline = computePipelines[i];
+        if (!pipeline.enabled)
+            continue;
 
-        vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
-        
-        //vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+        for (int j = 0; j < pipeline.pipelineInfo.bufferCount; j++)
+        {
+            VkBuffer destination = GetComputeDeviceBuffer(pipeline, j, currentFrameIndex);
+            if (!IsComputeBufferDoubleBuffered(pipeline.pipelineInfo.bufferInfoList[j]) || std::find(copied.begin(), copied.end(), destination) != copied.end())
+                continue;
 
-        vkCmdExecuteCommands(commandBuffers[i], 1, &renderPassBuffer);
+            if (copied.empty()) // the previous frame's dispatches and copies were submitted earlier on the same queue
+                MemoryBarrier(computeBuffers[currentFrameIndex], VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-        vkCmdEndRenderPass(commandBuffers[i]);
-        
-        result = vkEndCommandBuffer(commandBuffers[i]);
-        Assert(result == VK_SUCCESS);
+            VkBufferCopy copy = {};
+            copy.size = pipeline.pipelineInfo.bufferInfoList[j].size;
+            vkCmdCopyBuffer(computeBuffers[currentFrameIndex], GetComputeDeviceBuffer(pipeline, j, previousFrameIndex), destination, 1, &copy);
+            copied.push_back(destination);
+        }
     }
 
-    if (shouldPresent)
-        Present();
-    else
-        RecreateSwapChain();
-    currentFrameIndex = (currentFrameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
-
-    auto stop = std::chrono::high_resolution_clock::now();
-    double dt = std::max((double)(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - frameStartTime)).count(), 0.0);
-    currentFrameDelta = dt * pow(10, -6);
-    deltaTimes[frameCount] = currentFrameDelta;
-    frameCount++;
+    if (!copied.empty())
+        MemoryBarrier(computeBuffers[currentFrameIndex], VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT);
+}
 
-    if (frameCount == deltaTimes.size())
+void diamond::GetSharedComputeResources(std::vector<VkBuffer>& buffers, std::vector<VkImage>& images)
+{
+    // every single buffered compute resource which may be read by the graphics queue, i.e. vertex buffers and images
+    buffers.clear();
+    images.clear();
+    for (int i = 0; i < computePipelines.size(); i++)
     {
-        std::sort(deltaTimes.begin(), deltaTimes.end());
-        double avg = 0.f;
-        for (int i = 2; i < deltaTimes.size() - 3; i++)
+        const diamond_compute_pipeline& pipeline = computePipelines[i];
+        if (!pipeline.enabled)
+            continue;
+
+        for (int j = 0; j < pipeline.pipelineInfo.bufferCount; j++)
         {
-            avg += deltaTimes[i];
+            if (!pipeline.pipelineInfo.bufferInfoList[j].bindVertexBuffer || IsComputeBufferDoubleBuffered(pipeline.pipelineInfo.bufferInfoList[j]))
+                continue;
+            VkBuffer buffer = GetComputeDeviceBuffer(pipeline, j, 0);
+            if (std::find(buffers.begin(), buffers.end(), buffer) == buffers.end())
+                buffers.push_back(buffer);
+        }
+        for (int j = 0; j < pipeline.textureIndexes.size(); j++)
+        {
+            VkImage image = textureArray[pipeline.textureIndexes[j]].image;
+            if (std::find(images.begin(), images.end(), image) == images.end())
+                images.push_back(image);
         }
-        avg /= deltaTimes.size() - 6;
-
-        frameDelta = avg;
-        fps = 1.f / (frameDelta / 1000.f);
-
-        frameCount = 0;
     }
 }
 
-void diamond::SetGraphicsPipeline(int pipelineIndex)
+void diamond::TransferComputeOwnership(VkCommandBuffer cmd, u32 srcQueueFamily, u32 dstQueueFamily, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask)
 {
-    VkDeviceSize offsets[] = { 0 };
-    vkCmdBindVertexBuffers(renderPassBuffer, 0, 1, &graphicsPipelines[pipelineIndex].vertexBuffer, offsets);
-    vkCmdBindIndexBuffer(renderPassBuffer, graphicsPipelines[pipelineIndex].indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-    vkCmdBindPipeline(renderPassBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelines[pipelineIndex].pipeline);
+    // the release half ignores the destination access mask and the acquire half ignores the source access mask
+    if (ownershipBuffers.empty() && ownershipImages.empty())
+        return;
 
-    // todo: move to beginframe ?
-    vkCmdBindDescriptorSets(renderPassBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelines[pipelineIndex].pipelineLayout, 0, 1, &descriptorSets[nextImageIndex], 0, nullptr);
+    std::vector<VkBufferMemoryBarrier> bufferBarriers(ownershipBuffers.size());
+    for (int i = 0; i < ownershipBuffers.size(); i++)
+    {
+        bufferBarriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarriers[i].srcAccessMask = srcAccessMask;
+        bufferBarriers[i].dstAccessMask = dstAccessMask;
+        bufferBarriers[i].srcQueueFamilyIndex = srcQueueFamily;
+        bufferBarriers[i].dstQueueFamilyIndex = dstQueueFamily;
+        bufferBarriers[i].buffer = ownershipBuffers[i];
+        bufferBarriers[i].offset = 0;
+        bufferBarriers[i].size = VK_WHOLE_SIZE;
+    }
 
-    boundGraphicsPipelineIndex = pipelineIndex;
-}
+    std::vector<VkImageMemoryBarrier> imageBarriers(ownershipImages.size());
+    for (int i = 0; i < ownershipImages.size(); i++)
+    {
+        imageBarriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarriers[i].srcAccessMask = srcAccessMask;
+        imageBarriers[i].dstAccessMask = dstAccessMask;
+        imageBarriers[i].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarriers[i].srcQueueFamilyIndex = srcQueueFamily;
+        imageBarriers[i].dstQueueFamilyIndex = dstQueueFamily;
+        imageBarriers[i].image = ownershipImages[i];
+        imageBarriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageBarriers[i].subresourceRange.baseMipLevel = 0;
+        imageBarriers[i].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        imageBarriers[i].subresourceRange.baseArrayLayer = 0;
+        imageBarriers[i].subresourceRange.layerCount = 1;
+    }
 
-void diamond::MemoryBarrier(VkCommandBuffer cmd, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask)
-{
-    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
-    barrier.srcAccessMask = srcAccessMask;
-    barrier.dstAccessMask = dstAccessMask;
-    vkCmdPipelineBarrier(cmd, srcStageMask, dstStageMask, false, 1, &barrier, 0, nullptr, 0, nullptr);
+    vkCmdPipelineBarrier(
+        cmd,
+        srcStageMask, dstStageMask,
+        0,
+        0, nullptr,
+        static_cast<u32>(bufferBarriers.size()), bufferBarriers.data(),
+        static_cast<u32>(imageBarriers.size()), imageBarriers.data()
+    );
 }
 
 void diamond::Present()
 {
-    vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrameIndex], VK_TRUE, UINT64_MAX);
+    DIAMOND_PROFILE_FUNCTION();
 
     // check if a previous frame is using this image (i.e. there is its fence to wait on)
     if (imagesInFlight[nextImageIndex] != VK_NULL_HANDLE)
         vkWaitForFences(logicalDevice, 1, &imagesInFlight[nextImageIndex], VK_TRUE, UINT64_MAX);
+    imagesInFlight[nextImageIndex] = inFlightFences[currentFrameIndex];
+
+    UpdatePerFrameBuffer(currentFrameIndex);
+
+    // wait on the compute work of this frame before reading any of its results, and on the uploads it acquired (values are ignored for binary semaphores)
+    graphicsTimelineValue++;
+    // headless frames skip the swap chain semaphores, which are the last elements
+    u32 waitSemaphoreCount = headless ? 2 : 3;
+    u32 signalSemaphoreCount = headless ? 1 : 2;
+    VkSemaphore waitSemaphores[] = { computeTimeline, uploadTimeline, imageAvailableSemaphores[currentFrameIndex] };
+    u64 waitValues[] = { computeFrameValues[currentFrameIndex], uploadWaitValue, 0 };
+    VkPipelineStageFlags waitStages[] = {
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, // transfers generate the mips of compute images
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+    };
+    VkSemaphore signalSemaphores[] = { graphicsTimeline, renderFinishedSemaphores[currentFrameIndex] };
+    u64 signalValues[] = { graphicsTimelineValue, 0 };
 
-    UpdatePerFrameBuffer(nextImageIndex);
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = waitSemaphoreCount;
+    timelineInfo.pWaitSemaphoreValues = waitValues;
+    timelineInfo.signalSemaphoreValueCount = signalSemaphoreCount;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
 
-    VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrameIndex] };
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = waitSemaphoreCount;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[nextImageIndex];
-
-    VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrameIndex] };
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffers[currentFrameIndex];
+    submitInfo.signalSemaphoreCount = signalSemaphoreCount;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
     vkResetFences(logicalDevice, 1, &inFlightFences[currentFrameIndex]);
     VkResult result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrameIndex]);
     Assert(result == VK_SUCCESS);
+    graphicsQueriesSubmitted[currentFrameIndex] = true;
+
+    auto presentTime = std::chrono::steady_clock::now();
+    if (lastPresentTime.time_since_epoch().count() != 0)
+        AddFrameSample(presentIntervals, std::chrono::duration<double, std::milli>(presentTime - lastPresentTime).count());
+    lastPresentTime = presentTime;
+
+    if (headless)
+    {
+        lastRenderedImageIndex = static_cast<int>(nextImageIndex);
+        return;
+    }
 
     VkSwapchainKHR swapChains[] = { swapChain.swapChain };
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
+    presentInfo.pWaitSemaphores = &renderFinishedSemaphores[currentFrameIndex];
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = swapChains;
     presentInfo.pImageIndices = &nextImageIndex;
@@ -2458,17 +5404,18 @@ void diamond::Present()
     }
     else
         Assert(result == VK_SUCCESS);
-
-    vkQueueWaitIdle(presentQueue);
 }
 
 void diamond::Cleanup()
 {
+    StopTextureLoads();
     vkDeviceWaitIdle(logicalDevice);
+    CleanupUploadResources();
 
     #if DIAMOND_IMGUI
-    ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
+    CleanupImGui();
+    if (!headless)
+        ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
     #endif
 
@@ -2479,11 +5426,13 @@ void diamond::Cleanup()
 
     for (int i = 0; i < textureArray.size(); i++)
     {
-        if (textureArray[i].id != -1)
+        if (textureArray[i].id != -1 && textureArray[i].image != VK_NULL_HANDLE) // loading textures may not have an image yet
         {
             vkDestroyImageView(logicalDevice, textureArray[i].imageView, nullptr);
+            if (textureArray[i].storageView != VK_NULL_HANDLE)
+                vkDestroyImageView(logicalDevice, textureArray[i].storageView, nullptr);
             vkDestroyImage(logicalDevice, textureArray[i].image, nullptr);
-            vkFreeMemory(logicalDevice, textureArray[i].memory, nullptr);
+            FreeMemory(textureArray[i].memory);
             textureArray[i].id = -1;
         }
     }
@@ -2493,6 +5442,11 @@ void diamond::Cleanup()
         CleanupGraphics(graphicsPipelines[i]);
     }
 
+    for (int i = 0; i < staticMeshes.size(); i++)
+    {
+        CleanupStaticMesh(staticMeshes[i]);
+    }
+
     vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
 
     for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
@@ -2500,16 +5454,39 @@ void diamond::Cleanup()
         vkDestroySemaphore(logicalDevice, renderFinishedSemaphores[i], nullptr);
         vkDestroySemaphore(logicalDevice, imageAvailableSemaphores[i], nullptr);
         vkDestroyFence(logicalDevice, inFlightFences[i], nullptr);
+        vkDestroyBuffer(logicalDevice, uniformBuffers[i], nullptr);
+        FreeMemory(uniformBuffersMemory[i]);
     }
 
     for (int i = 0; i < computePipelines.size(); i++)
     {
         CleanupCompute(computePipelines[i]);
     }
-    vkDestroyFence(logicalDevice, computeFence, nullptr);
 
+    vkDestroySemaphore(logicalDevice, computeTimeline, nullptr);
+    vkDestroySemaphore(logicalDevice, graphicsTimeline, nullptr);
+
+    for (int i = 0; i < graphicsQueryPools.size(); i++)
+    {
+        vkDestroyQueryPool(logicalDevice, graphicsQueryPools[i], nullptr);
+        vkDestroyQueryPool(logicalDevice, computeQueryPools[i], nullptr);
+    }
+
+    for (int i = 0; i < recordingContexts.size(); i++)
+    {
+        DeleteRecordingContext(i);
+    }
+
+    for (int i = 0; i < frameCommandPools.size(); i++)
+    {
+        vkDestroyCommandPool(logicalDevice, frameCommandPools[i], nullptr);
+        vkDestroyCommandPool(logicalDevice, computeCommandPools[i], nullptr);
+    }
     vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    RetireDeletions(true);
+    CleanupMemoryPools();
+    if (!headless)
+        vkDestroySurfaceKHR(instance, surface, nullptr);
     vkDestroyDevice(logicalDevice, nullptr);
 
 #if DIAMOND_DEBUG
@@ -2522,12 +5499,24 @@ void diamond::Cleanup()
     vkDestroyInstance(instance, nullptr);
 
     // glfw cleanup
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (!headless)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+}
+
+void diamond::InitializeHeadless(int width, int height, const char* applicationName, const char* defaultTexturePath, bool enableAsyncCompute)
+{
+    headless = true;
+    headlessExtent = { static_cast<u32>(width), static_cast<u32>(height) };
+    Initialize(width, height, applicationName, defaultTexturePath, enableAsyncCompute);
 }
 
 bool diamond::IsRunning()
 {
+    if (headless) // there is no window to close, so the caller decides when to stop
+        return true;
     return !glfwWindowShouldClose(window);
 }
 
@@ -2538,7 +5527,13 @@ glm::vec2 diamond::GetWindowSize()
 
 void diamond::SetWindowSize(glm::vec2 size)
 {
-    glfwSetWindowSize(window, static_cast<int>(size.x), static_cast<int>(size.y));
+    if (headless)
+    {
+        headlessExtent = { static_cast<u32>(size.x), static_cast<u32>(size.y) };
+        RecreateSwapChain();
+    }
+    else
+        glfwSetWindowSize(window, static_cast<int>(size.x), static_cast<int>(size.y));
 }
 
 f32 diamond::GetAspectRatio()
@@ -2548,6 +5543,9 @@ f32 diamond::GetAspectRatio()
 
 void diamond::SetFullscreen(bool fullscreen)
 {
+    if (headless)
+        return;
+
     bool alreadyFullscreen = glfwGetWindowMonitor(window) != nullptr;
     if (alreadyFullscreen == fullscreen)
         return;
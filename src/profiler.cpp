@@ -0,0 +1,155 @@
+#include <Diamond/profiler.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#if DIAMOND_PROFILE
+
+// Ring of the most recent zones completed by one thread. Only the owning thread writes to it, and publishes each event by advancing
+// the head afterwards, so recording a zone never takes a lock
+struct diamond_profile_thread_buffer
+{
+    std::vector<diamond_profile_event> events = std::vector<diamond_profile_event>(diamond_profiler::MAX_EVENTS_PER_THREAD);
+    std::atomic<uint64_t> head = 0; // total number of events ever written
+    std::atomic<const char*> threadName = nullptr;
+    uint32_t threadId = 0;
+};
+
+// buffers are owned here rather than by the threads so that zones of threads which have exited can still be exported
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<diamond_profile_thread_buffer>> threadBuffers;
+static const std::chrono::steady_clock::time_point profilerEpoch = std::chrono::steady_clock::now();
+static thread_local diamond_profile_thread_buffer* threadBuffer = nullptr;
+
+static diamond_profile_thread_buffer* GetThreadBuffer()
+{
+    // only the first zone of every thread registers
+    if (!threadBuffer)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        threadBuffers.push_back(std::make_unique<diamond_profile_thread_buffer>());
+        threadBuffer = threadBuffers.back().get();
+        threadBuffer->threadId = static_cast<uint32_t>(threadBuffers.size());
+    }
+    return threadBuffer;
+}
+
+static void WriteJsonString(std::ostream& stream, const char* string)
+{
+    stream << '"';
+    for (const char* c = string; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            stream << '\\';
+        stream << *c;
+    }
+    stream << '"';
+}
+
+#endif
+
+uint64_t diamond_profiler::Now()
+{
+    #if DIAMOND_PROFILE
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profilerEpoch).count());
+    #else
+    return 0;
+    #endif
+}
+
+void diamond_profiler::RecordEvent(const char* name, uint64_t start, uint64_t end)
+{
+    #if DIAMOND_PROFILE
+    diamond_profile_thread_buffer* buffer = GetThreadBuffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    diamond_profile_event& event = buffer->events[head & (MAX_EVENTS_PER_THREAD - 1)];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    buffer->head.store(head + 1, std::memory_order_release);
+    #else
+    (void)name;
+    (void)start;
+    (void)end;
+    #endif
+}
+
+void diamond_profiler::SetThreadName(const char* name)
+{
+    #if DIAMOND_PROFILE
+    GetThreadBuffer()->threadName.store(name, std::memory_order_relaxed);
+    #else
+    (void)name;
+    #endif
+}
+
+bool diamond_profiler::ExportChromeTrace(const char* filePath)
+{
+    #if DIAMOND_PROFILE
+    std::ofstream file(filePath, std::ios::out | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::vector<diamond_profile_event> events;
+    bool first = true;
+    file << std::fixed << std::setprecision(3); // timestamps are in microseconds
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < threadBuffers.size(); i++)
+    {
+        diamond_profile_thread_buffer& buffer = *threadBuffers[i];
+
+        const char* threadName = buffer.threadName.load(std::memory_order_relaxed);
+        if (threadName)
+        {
+            file << (first ? "" : ",") << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer.threadId << ",\"args\":{\"name\":";
+            WriteJsonString(file, threadName);
+            file << "}}";
+            first = false;
+        }
+
+        // copy the events out first since the owning thread may keep writing, then drop whatever it overwrote in the meantime,
+        // including the slot of the event it might be in the middle of writing
+        uint64_t head = buffer.head.load(std::memory_order_acquire);
+        uint64_t tail = head > MAX_EVENTS_PER_THREAD ? head - MAX_EVENTS_PER_THREAD : 0;
+        events.clear();
+        for (uint64_t j = tail; j < head; j++)
+        {
+            events.push_back(buffer.events[j & (MAX_EVENTS_PER_THREAD - 1)]);
+        }
+        uint64_t newHead = buffer.head.load(std::memory_order_acquire);
+        uint64_t validTail = newHead + 1 > MAX_EVENTS_PER_THREAD ? newHead + 1 - MAX_EVENTS_PER_THREAD : 0;
+
+        for (uint64_t j = std::max(tail, validTail); j < head; j++)
+        {
+            const diamond_profile_event& event = events[j - tail];
+            file << (first ? "" : ",") << "\n{\"ph\":\"X\",\"name\":";
+            WriteJsonString(file, event.name);
+            file << ",\"pid\":1,\"tid\":" << buffer.threadId << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+            first = false;
+        }
+    }
+    file << "\n]}\n";
+
+    return file.good();
+    #else
+    (void)filePath;
+    return false;
+    #endif
+}
+
+void diamond_profiler::Clear()
+{
+    #if DIAMOND_PROFILE
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t i = 0; i < threadBuffers.size(); i++)
+    {
+        threadBuffers[i]->head.store(0, std::memory_order_release);
+    }
+    #endif
+}